@@ -317,8 +317,32 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads CNT sectors starting at SECTOR from partition P into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+partition_read_sectors (void *p_, block_sector_t sector, void *buffer,
+                        block_sector_t cnt)
+{
+  struct partition *p = p_;
+  block_read_sectors (p->block, p->start + sector, buffer, cnt);
+}
+
+/* Write CNT sectors starting at SECTOR to partition P from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block has acknowledged receiving the data. */
+static void
+partition_write_sectors (void *p_, block_sector_t sector, const void *buffer,
+                         block_sector_t cnt)
+{
+  struct partition *p = p_;
+  block_write_sectors (p->block, p->start + sector, buffer, cnt);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_sectors,
+    partition_write_sectors
   };
@@ -0,0 +1,41 @@
+/* fsstat.c
+
+   Prints the statistics of the file system and its buffer cache. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static void print_class (const char *name, const struct fsstat *, int class);
+
+int
+main (void)
+{
+  struct fsstat st;
+
+  if (!fsstat (&st))
+    {
+      printf ("fsstat failed\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("cache: %d sectors\n", st.cache_size);
+  printf ("disk: %llu reads of %llu sectors, %llu writes of %llu sectors\n",
+          st.read_requests, st.read_sectors,
+          st.write_requests, st.write_sectors);
+  print_class ("metadata", &st, FSSTAT_META);
+  print_class ("data", &st, FSSTAT_DATA);
+  return EXIT_SUCCESS;
+}
+
+/* Prints the buffer cache counters of CLASS in ST. */
+static void
+print_class (const char *name, const struct fsstat *st, int class)
+{
+  printf ("%s: %llu hits, %llu misses, %llu evictions, %llu writebacks\n",
+          name, st->hits[class], st->misses[class], st->evictions[class],
+          st->writebacks[class]);
+  printf ("%s: %llu read-ahead hits, %llu wasted, "
+          "%llu lock waits in %llu ticks\n",
+          name, st->ra_hits[class], st->ra_wasted[class],
+          st->lock_waits[class], st->lock_wait_ticks[class]);
+}
@@ -0,0 +1,410 @@
+/* pintos/src/filesys/cache-policy.c
+   Replacement policies of the buffer cache.
+   Every shard of the cache runs its own instance of the policy, which
+   orders the clusters of the shard.
+
+   lru   - least recently used.
+   clock - second chance, one reference bit per cluster.
+   2q    - 2Q of Johnson and Shasha: new clusters enter a FIFO queue and
+           are only promoted to the LRU queue when they are used again
+           after having been evicted, so a scan cannot flush hot clusters.
+   arc   - Adaptive Replacement Cache of Megiddo and Modha: balances a
+           recency and a frequency queue by the hits on their ghosts.
+
+   Whatever the policy, the cluster of FREE_MAP_SECTOR and ROOT_DIR_SECTOR
+   is never evicted.
+*/
+#include <string.h>
+#include <debug.h>
+#include "filesys/filesys.h"
+#include "filesys/cache.h"
+
+#define Q_RECENT  0  /* lru, clock: the only queue; 2q: A1in; arc: T1 */
+#define Q_FREQUENT 1 /* 2q: Am; arc: T2 */
+
+/* Queue helpers. */
+
+/* Append CLUSTER to QUEUE of SHARD as the most recently used cluster. */
+static void
+queue_push (struct cache_shard *shard, int queue,
+	    struct cache_cluster *cluster)
+{
+  cluster->queue = queue;
+  list_push_back (&shard->queues[queue], &cluster->list_elem);
+  shard->queue_len[queue]++;
+}
+
+/* Remove CLUSTER from its queue. */
+static void
+queue_remove (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  list_remove (&cluster->list_elem);
+  shard->queue_len[cluster->queue]--;
+}
+
+/* Return true if CLUSTER may be evicted: it is not pinned, and does not
+   hold FREE_MAP_SECTOR and ROOT_DIR_SECTOR, which stay in the cache. */
+static bool
+cluster_evictable (const struct cache_cluster *cluster)
+{
+  return cluster->pin_cnt == 0 && cluster->sector > ROOT_DIR_SECTOR;
+}
+
+/* Return the least recently used cluster of QUEUE which may be evicted. */
+static struct cache_cluster *
+queue_victim (struct cache_shard *shard, int queue)
+{
+  struct list_elem *e;
+  struct cache_cluster *cluster;
+
+  for (e = list_begin (&shard->queues[queue]);
+       e != list_end (&shard->queues[queue]); e = list_next (e)) {
+    cluster = list_entry (e, struct cache_cluster, list_elem);
+    if (cluster_evictable (cluster))
+      return cluster;
+  }
+  return NULL;
+}
+
+/* Ghost helpers. */
+
+static unsigned
+ghost_hash_value (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_ghost *g = hash_entry (e, struct cache_ghost, hash_elem);
+  return hash_bytes (&g->sector, sizeof g->sector);
+}
+
+static bool
+ghost_hash_less (const struct hash_elem *a, const struct hash_elem *b,
+		 void *aux UNUSED)
+{
+  const struct cache_ghost *ga = hash_entry (a, struct cache_ghost, hash_elem);
+  const struct cache_ghost *gb = hash_entry (b, struct cache_ghost, hash_elem);
+  return ga->sector < gb->sector;
+}
+
+/* Initialize the ghosts of SHARD with the CNT ghosts in GHOSTS. */
+void
+cache_ghost_init (struct cache_shard *shard, struct cache_ghost *ghosts,
+		  int cnt)
+{
+  int i;
+
+  hash_init (&shard->ghosts, ghost_hash_value, ghost_hash_less, NULL);
+  list_init (&shard->ghost_free);
+  for (i = 0; i < 2; i++) {
+    list_init (&shard->ghost_queues[i]);
+    shard->ghost_len[i] = 0;
+  }
+  for (i = 0; i < cnt; i++)
+    list_push_back (&shard->ghost_free, &ghosts[i].list_elem);
+}
+
+/* Return the ghost of SECTOR, or NULL if it is not remembered. */
+static struct cache_ghost *
+ghost_find (struct cache_shard *shard, block_sector_t sector)
+{
+  struct cache_ghost ghost;
+  struct hash_elem *e;
+
+  ghost.sector = sector;
+  e = hash_find (&shard->ghosts, &ghost.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_ghost, hash_elem) : NULL;
+}
+
+/* Forget GHOST. */
+static void
+ghost_remove (struct cache_shard *shard, struct cache_ghost *ghost)
+{
+  hash_delete (&shard->ghosts, &ghost->hash_elem);
+  list_remove (&ghost->list_elem);
+  shard->ghost_len[ghost->queue]--;
+  list_push_back (&shard->ghost_free, &ghost->list_elem);
+}
+
+/* Forget the oldest ghost of QUEUE, if any. */
+static void
+ghost_trim (struct cache_shard *shard, int queue)
+{
+  if (!list_empty (&shard->ghost_queues[queue]))
+    ghost_remove (shard, list_entry (list_front (&shard->ghost_queues[queue]),
+				     struct cache_ghost, list_elem));
+}
+
+/* Remember SECTOR on ghost QUEUE.  The oldest ghost of the queue is
+   forgotten when all ghosts are in use. */
+static void
+ghost_add (struct cache_shard *shard, int queue, block_sector_t sector)
+{
+  struct cache_ghost *ghost;
+
+  if (list_empty (&shard->ghost_free))
+    ghost_trim (shard, shard->ghost_len[queue] > 0 ? queue : !queue);
+  if (list_empty (&shard->ghost_free))
+    return;
+  ghost = list_entry (list_pop_front (&shard->ghost_free), struct cache_ghost,
+		      list_elem);
+  ghost->sector = sector;
+  ghost->queue = queue;
+  hash_insert (&shard->ghosts, &ghost->hash_elem);
+  list_push_back (&shard->ghost_queues[queue], &ghost->list_elem);
+  shard->ghost_len[queue]++;
+}
+
+/* Queues shared by lru, clock and 2q. */
+
+static void
+queues_init (struct cache_shard *shard)
+{
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    list_init (&shard->queues[i]);
+    shard->queue_len[i] = 0;
+  }
+  shard->target = 0;
+  shard->hand = NULL;
+}
+
+static void
+queues_remove (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  queue_remove (shard, cluster);
+}
+
+/* LRU. */
+
+static void
+lru_hit (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  queue_remove (shard, cluster);
+  queue_push (shard, Q_RECENT, cluster);
+}
+
+static void
+lru_insert (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  queue_push (shard, Q_RECENT, cluster);
+}
+
+static struct cache_cluster *
+lru_victim (struct cache_shard *shard, block_sector_t sector UNUSED)
+{
+  return queue_victim (shard, Q_RECENT);
+}
+
+static const struct cache_policy lru_policy =
+  {"lru", queues_init, lru_hit, lru_insert, queues_remove, lru_victim};
+
+/* CLOCK.  The queue is the clock, the hand moves toward its back and
+   wraps around to its front. */
+
+static void
+clock_hit (struct cache_shard *shard UNUSED, struct cache_cluster *cluster)
+{
+  cluster->referenced = true;
+}
+
+static void
+clock_insert (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  cluster->referenced = false;
+  cluster->queue = Q_RECENT;
+  // the hand reaches a new cluster last
+  if (shard->hand == NULL)
+    list_push_back (&shard->queues[Q_RECENT], &cluster->list_elem);
+  else
+    list_insert (shard->hand, &cluster->list_elem);
+  shard->queue_len[Q_RECENT]++;
+}
+
+/* Advance the clock hand past E. */
+static struct list_elem *
+clock_next (struct cache_shard *shard, struct list_elem *e)
+{
+  e = list_next (e);
+  return e != list_end (&shard->queues[Q_RECENT]) ? e : NULL;
+}
+
+static void
+clock_remove (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  if (shard->hand == &cluster->list_elem)
+    shard->hand = clock_next (shard, shard->hand);
+  queue_remove (shard, cluster);
+}
+
+static struct cache_cluster *
+clock_victim (struct cache_shard *shard, block_sector_t sector UNUSED)
+{
+  struct cache_cluster *cluster;
+  int steps;
+
+  // two turns of the hand clear all reference bits
+  for (steps = 2 * shard->queue_len[Q_RECENT]; steps >= 0; steps--) {
+    if (shard->hand == NULL)
+      shard->hand = list_begin (&shard->queues[Q_RECENT]);
+    if (shard->hand == list_end (&shard->queues[Q_RECENT]))
+      return NULL;
+    cluster = list_entry (shard->hand, struct cache_cluster, list_elem);
+    shard->hand = clock_next (shard, shard->hand);
+    if (!cluster_evictable (cluster))
+      continue;
+    if (!cluster->referenced)
+      return cluster;
+    cluster->referenced = false;
+  }
+  return NULL;
+}
+
+static const struct cache_policy clock_policy =
+  {"clock", queues_init, clock_hit, clock_insert, clock_remove, clock_victim};
+
+/* 2Q.  Q_RECENT is the FIFO A1in holding at most a quarter of the
+   clusters, ghost queue Q_RECENT is A1out remembering half as many
+   clusters as the shard owns, and Q_FREQUENT is the LRU queue Am. */
+
+static void
+twoq_hit (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  // a hit in A1in is likely correlated to the first reference, ignore it
+  if (cluster->queue == Q_FREQUENT) {
+    queue_remove (shard, cluster);
+    queue_push (shard, Q_FREQUENT, cluster);
+  }
+}
+
+static void
+twoq_insert (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  struct cache_ghost *ghost = ghost_find (shard, cluster->sector);
+
+  if (ghost != NULL) {
+    // used again after it has left A1in
+    ghost_remove (shard, ghost);
+    queue_push (shard, Q_FREQUENT, cluster);
+  } else {
+    queue_push (shard, Q_RECENT, cluster);
+  }
+}
+
+static void
+twoq_remove (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  int kout = shard->capacity / 2 > 1 ? shard->capacity / 2 : 1;
+
+  queue_remove (shard, cluster);
+  if (cluster->queue == Q_RECENT) {
+    while (shard->ghost_len[Q_RECENT] >= kout)
+      ghost_trim (shard, Q_RECENT);
+    ghost_add (shard, Q_RECENT, cluster->sector);
+  }
+}
+
+static struct cache_cluster *
+twoq_victim (struct cache_shard *shard, block_sector_t sector UNUSED)
+{
+  int kin = shard->capacity / 4 > 1 ? shard->capacity / 4 : 1;
+  struct cache_cluster *cluster = NULL;
+
+  if (shard->queue_len[Q_RECENT] > kin)
+    cluster = queue_victim (shard, Q_RECENT);
+  if (cluster == NULL)
+    cluster = queue_victim (shard, Q_FREQUENT);
+  if (cluster == NULL)
+    cluster = queue_victim (shard, Q_RECENT);
+  return cluster;
+}
+
+static const struct cache_policy twoq_policy =
+  {"2q", queues_init, twoq_hit, twoq_insert, twoq_remove, twoq_victim};
+
+/* ARC.  Q_RECENT is T1 holding clusters used once lately, Q_FREQUENT is T2
+   holding clusters used at least twice, and the ghost queues B1 and B2
+   remember the clusters evicted from them.  TARGET is the length of T1 the
+   policy aims at: a hit in B1 shows T1 was too short and increases it, a
+   hit in B2 decreases it. */
+
+static void
+arc_hit (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  queue_remove (shard, cluster);
+  queue_push (shard, Q_FREQUENT, cluster);
+}
+
+static void
+arc_insert (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  struct cache_ghost *ghost = ghost_find (shard, cluster->sector);
+  int delta;
+
+  if (ghost == NULL) {
+    // T1 and B1 together remember at most capacity clusters
+    if (shard->queue_len[Q_RECENT] + shard->ghost_len[Q_RECENT]
+	>= shard->capacity)
+      ghost_trim (shard, Q_RECENT);
+    queue_push (shard, Q_RECENT, cluster);
+    return;
+  }
+
+  if (ghost->queue == Q_RECENT) {
+    delta = shard->ghost_len[Q_RECENT] >= shard->ghost_len[Q_FREQUENT]
+	    ? 1 : shard->ghost_len[Q_FREQUENT] / shard->ghost_len[Q_RECENT];
+    shard->target = shard->target + delta < shard->capacity
+		    ? shard->target + delta : shard->capacity;
+  } else {
+    delta = shard->ghost_len[Q_FREQUENT] >= shard->ghost_len[Q_RECENT]
+	    ? 1 : shard->ghost_len[Q_RECENT] / shard->ghost_len[Q_FREQUENT];
+    shard->target = shard->target - delta > 0 ? shard->target - delta : 0;
+  }
+  ghost_remove (shard, ghost);
+  queue_push (shard, Q_FREQUENT, cluster);
+}
+
+static void
+arc_remove (struct cache_shard *shard, struct cache_cluster *cluster)
+{
+  queue_remove (shard, cluster);
+  ghost_add (shard, cluster->queue, cluster->sector);
+}
+
+static struct cache_cluster *
+arc_victim (struct cache_shard *shard, block_sector_t sector)
+{
+  struct cache_ghost *ghost = ghost_find (shard, sector);
+  int t1 = shard->queue_len[Q_RECENT];
+  struct cache_cluster *cluster = NULL;
+
+  if (t1 > 0 && (t1 > shard->target
+		 || (ghost != NULL && ghost->queue == Q_FREQUENT
+		     && t1 == shard->target)))
+    cluster = queue_victim (shard, Q_RECENT);
+  if (cluster == NULL)
+    cluster = queue_victim (shard, Q_FREQUENT);
+  if (cluster == NULL)
+    cluster = queue_victim (shard, Q_RECENT);
+  return cluster;
+}
+
+static const struct cache_policy arc_policy =
+  {"arc", queues_init, arc_hit, arc_insert, arc_remove, arc_victim};
+
+static const struct cache_policy *policies[] =
+  {&lru_policy, &clock_policy, &twoq_policy, &arc_policy, NULL};
+const struct cache_policy *cache_policy = &lru_policy;
+
+/* Selects the replacement policy called NAME.  Returns false if there is
+   no such policy. */
+bool
+cache_policy_select (const char *name)
+{
+  int i;
+
+  for (i = 0; policies[i] != NULL; i++)
+    if (!strcmp (name, policies[i]->name)) {
+      cache_policy = policies[i];
+      return true;
+    }
+  return false;
+}
@@ -3,91 +3,286 @@
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <round.h>
 #include "devices/timer.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/interrupt.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/cache.h"
+#include "filesys/journal.h"
 
-struct hash buffer_cache;     /* hash table maintaining the buffer */
-struct list list_lru;         /* free list preserves the LRU order */
-struct semaphore sema_lru;    /* event to indicate a free buffer is available */
-struct lock lock_buffercache; /* lock when accessing buffer cache hash table */
+static struct cache_shard shards[CACHE_SHARD_CNT]; /* the buffer cache */
+static int shard_cnt;                /* number of shards in use */
 
-//static struct cache_entry *breada (struct block *block, block_sector_t sector,
-//				   block_sector_t sector_next);
+/* A sector queued for the read-ahead thread. */
+struct readahead
+{
+  block_sector_t sector;
+  enum cache_class class;
+};
+
+/* Sectors queued for the read-ahead thread, a circular buffer. */
+static struct readahead ra_queue[CACHE_RA_QUEUE];
+static int ra_head;                  /* index of the oldest queued sector */
+static int ra_cnt;                   /* number of queued sectors */
+static struct lock lock_readahead;   /* lock when accessing ra_queue */
+static struct semaphore sema_readahead; /* event a sector is queued */
+
+/* Delayed write buffers in the order they became dirty. */
+static struct list list_dirty;
+static int dirty_cnt;                /* number of buffers in list_dirty */
+static struct lock lock_dirty;       /* lock when accessing list_dirty */
+static block_sector_t wb_head;       /* sector after the last one written */
+static struct semaphore sema_flush;  /* event the write-behind daemon is due */
+static bool flush_due;               /* sema_flush is up, not taken yet */
+
+/* Statistics of the buffer cache.  The counters are not locked, a lost
+   update now and then does not matter. */
+static struct fsstat stats;
+
+int cache_size = BUFFER_CACHE_SIZE;
+int cache_dirty_age = 1000;
+int cache_dirty_ratio = 25;
+
+static struct cache_shard *cache_shard (block_sector_t sector);
+static void cache_prefetch (block_sector_t sector, enum cache_class class);
+static void cache_load (struct cache_entry *buffer);
+static void cache_flush_run (struct cache_entry *buffer, int cnt);
+static void cache_flush_around (struct cache_entry *buffer);
+static void cache_flush_cluster (struct cache_cluster *cluster);
+static void cluster_unpin (struct cache_cluster *cluster);
+static int cache_writeback (int64_t age);
+static void cache_tick_task (void *AUX UNUSED);
+static struct cache_entry *cache_get_write (block_sector_t sector, int ofs,
+					    int size, bool fresh,
+					    enum cache_class class);
 
 /* cache buffer initial do:
-   1. create hash table
-   2. create free list
-   3. initial semaphore sema_lru
-   4. allocate kernel pages of 64 block size and assign to free list
-   5. initial a thread to flush cache buffer periodically
+   1. create the hash table, free list, policy queues, ghosts and semaphore
+      sema_lru of each shard; there are as many shards as there are
+      CACHE_SHARD_MIN clusters, up to CACHE_SHARD_CNT
+   2. allocate cache_size buffers in clusters of CACHE_CLUSTER_SECTORS, each
+      cluster takes a page of the user pool for its data, and deal the
+      clusters out to the shards
+   3. initial a thread to write back delayed write buffers
+   4. initial a thread to read queued sectors ahead
 */
 void cache_init (void)
 {
   struct cache_entry *buffer;
-  int i;
+  struct cache_cluster *cluster;
+  struct cache_shard *shard;
+  struct cache_ghost *ghosts;
+  int clusters;
+  int i, j;
 
-  hash_init (&buffer_cache, cache_hash_value, cache_hash_less, NULL);
-  list_init (&list_lru);
-  sema_init (&sema_lru, 0);
-  lock_init (&lock_buffercache);
+  clusters = DIV_ROUND_UP (cache_size, CACHE_CLUSTER_SECTORS);
+  if (clusters < CACHE_SHARD_MIN)
+    clusters = CACHE_SHARD_MIN;
+  cache_size = clusters * CACHE_CLUSTER_SECTORS;
+  shard_cnt = clusters / CACHE_SHARD_MIN;
+  if (shard_cnt > CACHE_SHARD_CNT)
+    shard_cnt = CACHE_SHARD_CNT;
 
-  for (i = 0; i < BUFFER_CACHE_SIZE; i++) {
-    buffer = malloc (sizeof (struct cache_entry));
-    buffer->seq = i;
-    buffer->sector = (block_sector_t) -1;
-    memset (buffer->data, 0, BLOCK_SECTOR_SIZE);
-    buffer->status = 0;
-    sema_init (&buffer->sema_buf, 1);
-    init_shared (&buffer->lock_shared);
-    list_push_back (&list_lru, &buffer->list_elem);
+  for (i = 0; i < shard_cnt; i++) {
+    shard = &shards[i];
+    hash_init (&shard->clusters, cache_hash_value, cache_hash_less, NULL);
+    list_init (&shard->owned);
+    list_init (&shard->list_free);
+    shard->capacity = (clusters - i + shard_cnt - 1) / shard_cnt;
+    // 2Q and ARC remember as many evicted clusters as there are clusters
+    ghosts = malloc (shard->capacity * sizeof *ghosts);
+    if (ghosts == NULL)
+      PANIC ("buffer cache allocation failed");
+    cache_ghost_init (shard, ghosts, shard->capacity);
+    cache_policy->init (shard);
+    sema_init (&shard->sema_lru, 0);
+    lock_init (&shard->lock);
   }
-  /*Initial a thread to flush cache buffer every one second. */
-  /*TODO: after adding this thread, cases with concurrent processes are failed*/
+
+  for (i = 0; i < clusters; i++) {
+    shard = &shards[i % shard_cnt];
+    cluster = malloc (sizeof *cluster);
+    if (cluster == NULL)
+      PANIC ("buffer cache allocation failed");
+    cluster->kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+    if (cluster->kpage == NULL)
+      PANIC ("buffer cache allocation failed");
+    cluster->seq = i;
+    cluster->sector = (block_sector_t) -1;
+    cluster->pin_cnt = 0;
+    cluster->shard = shard;
+    cluster->queue = 0;
+    cluster->referenced = false;
+    cluster->last_sector = (block_sector_t) -1;
+    cluster->use_time = 0;
+    list_push_back (&shard->owned, &cluster->elem);
+    list_push_back (&shard->list_free, &cluster->list_elem);
+
+    for (j = 0; j < CACHE_CLUSTER_SECTORS; j++) {
+      buffer = &cluster->buffers[j];
+      buffer->seq = i * CACHE_CLUSTER_SECTORS + j;
+      buffer->sector = (block_sector_t) -1;
+      buffer->data = (char *) cluster->kpage + j * BLOCK_SECTOR_SIZE;
+      buffer->status = 0;
+      buffer->cluster = cluster;
+      buffer->class = CACHE_DATA;
+      buffer->prefetched = false;
+      buffer->jseq = 0;
+      sema_init (&buffer->sema_buf, 1);
+      init_shared (&buffer->lock_shared);
+    }
+  }
+  list_init (&list_dirty);
+  lock_init (&lock_dirty);
+  dirty_cnt = 0;
+  sema_init (&sema_flush, 0);
+  flush_due = false;
+  lock_init (&lock_readahead);
+  sema_init (&sema_readahead, 0);
+  ra_head = ra_cnt = 0;
+
+  /*Initial a thread to write back aged delayed write buffers. */
   thread_create ("CACHE_FLUSH", PRI_DEFAULT, cache_flush_task, NULL);
+  thread_create ("CACHE_TICK", PRI_DEFAULT, cache_tick_task, NULL);
+  thread_create ("CACHE_READAHEAD", PRI_DEFAULT, cache_readahead_task, NULL);
+}
+
+/* Return the first sector of the cluster holding SECTOR. */
+static block_sector_t
+cluster_first (block_sector_t sector)
+{
+  return sector - sector % CACHE_CLUSTER_SECTORS;
+}
+
+/* Return the shard a sector belongs to.  Consecutive clusters are spread
+   over different shards. */
+static struct cache_shard *
+cache_shard (block_sector_t sector)
+{
+  return &shards[sector / CACHE_CLUSTER_SECTORS % shard_cnt];
 }
 
 /* Return the hash value of the hash element ce on the value of sector. */
 unsigned
 cache_hash_value (const struct hash_elem *ce, void *aux UNUSED)
 {
-  const struct cache_entry *c = hash_entry (ce, struct cache_entry, hash_elem);
+  const struct cache_cluster *c = hash_entry (ce, struct cache_cluster,
+					      hash_elem);
   return hash_bytes (&c->sector, sizeof c->sector);
 }
 
-/* Returns true if cache entry a precedes cache entry b on the value of sector.
+/* Returns true if cluster a precedes cluster b on the value of sector.
  */
 bool
 cache_hash_less (const struct hash_elem *a, const struct hash_elem *b,
 		void *aux UNUSED)
 {
-  const struct cache_entry *ca = hash_entry (a, struct cache_entry, hash_elem);
-  const struct cache_entry *cb = hash_entry (b, struct cache_entry, hash_elem);
+  const struct cache_cluster *ca = hash_entry (a, struct cache_cluster,
+					       hash_elem);
+  const struct cache_cluster *cb = hash_entry (b, struct cache_cluster,
+					       hash_elem);
   return ca->sector < cb->sector;
 }
 
-/*
-  Return a cache entry of the buffer cache for the specific file block.
-  Return NULL if not found.
- */
-struct cache_entry *
-cache_lookup (block_sector_t sector)
+/* Find the cluster starting at SECTOR in SHARD, which must be locked by
+   the caller. */
+static struct cache_cluster *
+shard_find (struct cache_shard *shard, block_sector_t sector)
 {
-  struct cache_entry buffer;
+  struct cache_cluster cluster;
   struct hash_elem *e;
 
-  buffer.sector = sector;
-  lock_acquire (&lock_buffercache);
-  e = hash_find (&buffer_cache, &buffer.hash_elem);
-  lock_release (&lock_buffercache);
+  cluster.sector = sector;
+  e = hash_find (&shard->clusters, &cluster.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_cluster, hash_elem) : NULL;
+}
+
+/* Pin CLUSTER, which must be in a locked shard, so it cannot be evicted. */
+static void
+shard_pin (struct cache_cluster *cluster)
+{
+  cluster->pin_cnt++;
+}
+
+/* Return true if any buffer of CLUSTER is delayed write. */
+static bool
+cluster_is_delayed (struct cache_cluster *cluster)
+{
+  int i;
 
-  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+  for (i = 0; i < CACHE_CLUSTER_SECTORS; i++)
+    if (buffer_is_delayed (&cluster->buffers[i]))
+      return true;
+  return false;
 }
+
+/* Return true if any buffer of CLUSTER waits for its journal transaction
+   to commit before it may be written. */
+static bool
+cluster_is_pending (struct cache_cluster *cluster)
+{
+  int i;
+
+  for (i = 0; i < CACHE_CLUSTER_SECTORS; i++)
+    if (journal_pending (&cluster->buffers[i]))
+      return true;
+  return false;
+}
+
+/* Lock SHARD, counting the time spent waiting for it to CLASS. */
+static void
+shard_lock (struct cache_shard *shard, enum cache_class class)
+{
+  int64_t start;
+
+  if (lock_try_acquire (&shard->lock))
+    return;
+  start = timer_ticks ();
+  lock_acquire (&shard->lock);
+  stats.lock_waits[class]++;
+  stats.lock_wait_ticks[class] += timer_elapsed (start);
+}
+
+/* Lock BUFFER exclusively, counting the time spent waiting for it to
+   CLASS. */
+static void
+buffer_lock (struct cache_entry *buffer, enum cache_class class)
+{
+  int64_t start;
+
+  if (try_acquire_exclusive (&buffer->lock_shared))
+    return;
+  start = timer_ticks ();
+  acquire_exclusive (&buffer->lock_shared);
+  stats.lock_waits[class]++;
+  stats.lock_wait_ticks[class] += timer_elapsed (start);
+}
+
+/* Count the sectors of CLUSTER leaving the cache as evicted, and those read
+   ahead but never used as wasted. */
+static void
+cluster_evicted (struct cache_cluster *cluster)
+{
+  struct cache_entry *buffer;
+  int i;
+
+  for (i = 0; i < CACHE_CLUSTER_SECTORS; i++) {
+    buffer = &cluster->buffers[i];
+    if (!buffer_is_valid (buffer))
+      continue;
+    stats.evictions[buffer->class]++;
+    if (buffer->prefetched)
+      stats.ra_wasted[buffer->class]++;
+    buffer->prefetched = false;
+  }
+}
+
 /* Scenarios for retrieval of a buffer (see chapter 3 Buffer Cache of 
    the Design of the Unix Operating System, Maurice J. Bach)
    1. The kernel find the block on its hash queue, and its buffer is free
@@ -101,185 +296,702 @@ cache_lookup (block_sector_t sector)
       buffer is empty.
    5. The kernel finds the block on the hash queue, but its buffer is currently
       busy.
+   The hash queue holds whole clusters, and which cluster is free to be
+   reused is decided by the replacement policy.
+   Only the shard of the sector is locked, and only while the hash table and
+   the policy queues are manipulated.  The returned buffer is pinned and locked
+   exclusively; its data must be read from disk if it is not valid yet.
+   CLASS is the kind of data for the statistics.  A lookup for PREFETCH
+   does not count as a use of the sector.
+   A lookup correlated to an earlier use of the cluster is not passed to
+   the policy as a hit either: one within CACHE_CORRELATED ticks of the
+   last use counted, or one of the sector after the one looked up last,
+   as by a sequential read going through the sectors of the cluster.
+   Otherwise a single scan would look like repeated use to 2Q and ARC.
 */
-struct cache_entry *cache_get_block (block_sector_t sector)
+static struct cache_entry *
+cache_get (block_sector_t sector, enum cache_class class, bool prefetch)
 {
-  bool found = false;
+  struct cache_shard *shard = cache_shard (sector);
+  block_sector_t first = cluster_first (sector);
+  struct cache_cluster *cluster;
   struct cache_entry *buffer;
-  enum intr_level old_level;
-
-  while (!found) {
-    buffer = cache_lookup (sector);
-    if (buffer != NULL) {
-      //scenario 5, wait event the buffer becomes free 
-      acquire_exclusive (&buffer->lock_shared);
-      if (buffer->sector != sector) { // reckeck the sector after wait up
-	release_exclusive (&buffer->lock_shared);
-	continue;
-      }
-      //disable interrupt while manuplating the free list
-      if (sector > ROOT_DIR_SECTOR) {
-	old_level = intr_disable (); //scenario 1
-	list_remove (&buffer->list_elem);
-	intr_set_level (old_level);
-      }
+  int i;
 
-      found = true;
-    } else { // block not on hash queue
-      if (list_empty (&list_lru)) {        //scenario 4
-	sema_down (&sema_lru);    //wait event any buffer becomes free    
+  for (;;) {
+    shard_lock (shard, class);
+    cluster = shard_find (shard, first);
+    if (cluster != NULL) {
+      //scenario 1 and 5, pin the buffer and wait event it becomes free
+      if (!prefetch) {
+	if (timer_elapsed (cluster->use_time) >= CACHE_CORRELATED
+	    && sector != cluster->last_sector + 1) {
+	  cache_policy->hit (shard, cluster);
+	  cluster->use_time = timer_ticks ();
+	}
+	cluster->last_sector = sector;
+      }
+      shard_pin (cluster);
+      lock_release (&shard->lock);
+      break;
+    }
+    // block not on hash queue
+    if (!list_empty (&shard->list_free)) {
+      // a cluster never used yet
+      cluster = list_entry (list_pop_front (&shard->list_free),
+			    struct cache_cluster, list_elem);
+    } else {
+      cluster = cache_policy->victim (shard, first);
+      if (cluster == NULL) {               //scenario 4
+	lock_release (&shard->lock);
+	sema_down (&shard->sema_lru);    //wait event any cluster becomes free
 	continue;
       }
-      //disable interrupt while manuplating the free list
-      old_level = intr_disable ();
-      buffer = list_entry(list_pop_front(&list_lru), struct cache_entry,
-			  list_elem);
-      intr_set_level (old_level);
-      if (buffer == NULL)
+      if (cluster_is_delayed (cluster)) { //scenario 3
+	// write buffers to disk, keep them hashed to serve their own sectors;
+	// metadata is logged first
+	shard_pin (cluster);
+	lock_release (&shard->lock);
+	if (cluster_is_pending (cluster))
+	  journal_commit ();
+	cache_flush_cluster (cluster);
+	cluster_unpin (cluster);
 	continue;
-      else {
-	if (buffer_is_delayed (buffer)) { //scenario 3
-	  // asynchronous write buffer to disk
-	  acquire_shared (&buffer->lock_shared);
-	  cache_flush_buffer (buffer);
-	  release_shared (&buffer->lock_shared);
-	}
-	acquire_exclusive (&buffer->lock_shared);
       }
-      //scenarion 2: found a free buffer
-      lock_acquire (&lock_buffercache);
-      hash_delete (&buffer_cache, &buffer->hash_elem);
-      lock_release (&lock_buffercache);
+      cache_policy->remove (shard, cluster);
+      hash_delete (&shard->clusters, &cluster->hash_elem);
+      cluster_evicted (cluster);
+    }
+    //scenarion 2: found a free cluster, rehash it to the new sectors
+    shard_pin (cluster);
+    cluster->sector = first;
+    // a sector read ahead is first used by the read it was read ahead for
+    cluster->last_sector = prefetch ? sector - 1 : sector;
+    cluster->use_time = timer_ticks ();
+    for (i = 0; i < CACHE_CLUSTER_SECTORS; i++) {
+      cluster->buffers[i].sector = first + i;
+      buffer_set_valid (&cluster->buffers[i], false);
+    }
+    hash_insert (&shard->clusters, &cluster->hash_elem);
+    cache_policy->insert (shard, cluster);
+    lock_release (&shard->lock);
+    break;
+  }
 
-      found = true;
+  buffer = &cluster->buffers[sector - first];
+  buffer_lock (buffer, class);
+  if (!prefetch) {
+    if (buffer_is_valid (buffer))
+      stats.hits[class]++;
+    else
+      stats.misses[class]++;
+    if (buffer->prefetched) {
+      stats.ra_hits[buffer->class]++;
+      buffer->prefetched = false;
     }
+    buffer->class = class;
   }
   return buffer;
 }
 
+/* Return the buffer of SECTOR, which holds CLASS of data.  See
+   cache_get. */
+struct cache_entry *cache_get_block (block_sector_t sector,
+				     enum cache_class class)
+{
+  return cache_get (sector, class, false);
+}
+
+/* Unpin CLUSTER, the policy may evict it if nobody uses it. */
+static void
+cluster_unpin (struct cache_cluster *cluster)
+{
+  struct cache_shard *shard = cluster->shard;
+
+  lock_acquire (&shard->lock);
+  ASSERT (cluster->pin_cnt > 0);
+  if (--cluster->pin_cnt == 0)
+    sema_up (&shard->sema_lru);
+  lock_release (&shard->lock);
+}
+
+/*
+  Unpin the cluster of the cache entry.
+*/
+void cache_unpin (struct cache_entry *buffer)
+{
+  cluster_unpin (buffer->cluster);
+}
+
 /*
   Release the cache entry when kernel finishing using the buffer
 */
 void cache_release (struct cache_entry *buffer)
 {
-  enum intr_level old_level;
-  
-  // FREE_MAP_SECTOR and ROOT_DIR_SECTOR are pinned in buffer cache
-  if (buffer->sector > ROOT_DIR_SECTOR) {
-    //disable interrupt while manuplating the free list
-    old_level = intr_disable ();
-    list_push_back (&list_lru, &buffer->list_elem);
-    intr_set_level (old_level);
-    sema_up (&sema_lru);
-  }
   release_exclusive (&buffer->lock_shared);
+  cache_unpin (buffer);
 }
 
 void cache_flush_buffer (struct cache_entry *buffer)
 {
+  cache_flush_run (buffer, 1);
+}
+
+/* Write CNT adjacent buffers of a cluster starting at BUFFER to disk with a
+   single request.  The caller holds all of them locked in shared mode. */
+static void cache_flush_run (struct cache_entry *buffer, int cnt)
+{
+  int i;
+
   //initiate disk write
-  block_write (fs_device, buffer->sector, buffer->data);
-  buffer_set_delayed(buffer, false);
-  CDEBUG ("cache-flush: buffer[%d] to %s[%d].\n", buffer->seq,
-	  block_type_name(block_type(fs_device)), buffer->sector);
+  block_write_sectors (fs_device, buffer->sector, buffer->data, cnt);
+  stats.write_requests++;
+  stats.write_sectors += cnt;
+  wb_head = buffer->sector + cnt;
+  for (i = 0; i < cnt; i++) {
+    stats.writebacks[buffer[i].class]++;
+    buffer_set_delayed (&buffer[i], false);
+  }
+  CDEBUG ("cache-flush: buffer[%d] to %s[%d], %d sectors.\n", buffer->seq,
+	  block_type_name(block_type(fs_device)), buffer->sector, cnt);
+}
+
+/* Lock BUFFER in shared mode for cache_flush_around if it is delayed write,
+   not waiting for the journal, and nobody holds it exclusively.  Return true
+   if it is locked. */
+static bool
+cache_claim_delayed (struct cache_entry *buffer)
+{
+  if (!buffer_is_delayed (buffer) || journal_pending (buffer)
+      || !try_acquire_shared (&buffer->lock_shared))
+    return false;
+  if (!buffer_is_delayed (buffer) || journal_pending (buffer)) {
+    release_shared (&buffer->lock_shared);
+    return false;
+  }
+  return true;
+}
+
+/* Write BUFFER to disk if it is delayed write, with the delayed write
+   buffers adjacent to it in its cluster, by a single request.  The cluster
+   must be pinned.  Only BUFFER is waited for; a neighbour that cannot be
+   locked at once ends the run.  A buffer whose journal transaction has not
+   committed yet is left alone. */
+static void cache_flush_around (struct cache_entry *buffer)
+{
+  struct cache_entry *buffers = buffer->cluster->buffers;
+  int idx = buffer - buffers;
+  int first = idx, last = idx, i;
+
+  acquire_shared (&buffer->lock_shared);
+  if (!buffer_is_delayed (buffer) || journal_pending (buffer)) {
+    release_shared (&buffer->lock_shared);
+    return;
+  }
+  while (first > 0 && cache_claim_delayed (&buffers[first - 1]))
+    first--;
+  while (last + 1 < CACHE_CLUSTER_SECTORS
+	 && cache_claim_delayed (&buffers[last + 1]))
+    last++;
+
+  cache_flush_run (&buffers[first], last - first + 1);
+  for (i = first; i <= last; i++)
+    release_shared (&buffers[i].lock_shared);
+}
+
+/* Write the delayed write buffers of CLUSTER, which must be pinned, to
+   disk.  Each run of adjacent delayed write buffers goes in one request. */
+void cache_flush_cluster (struct cache_cluster *cluster)
+{
+  int i;
+
+  for (i = 0; i < CACHE_CLUSTER_SECTORS; i++)
+    if (buffer_is_delayed (&cluster->buffers[i]))
+      cache_flush_around (&cluster->buffers[i]);
+}
+
+/* Write the buffer of SECTOR to disk if it is cached and delayed write. */
+void cache_flush_block (block_sector_t sector)
+{
+  struct cache_shard *shard = cache_shard (sector);
+  struct cache_cluster *cluster;
+  struct cache_entry *buffer;
+
+  lock_acquire (&shard->lock);
+  cluster = shard_find (shard, cluster_first (sector));
+  buffer = (cluster != NULL
+	    ? &cluster->buffers[sector % CACHE_CLUSTER_SECTORS] : NULL);
+  if (buffer == NULL || !buffer_is_delayed (buffer)) {
+    lock_release (&shard->lock);
+    return;
+  }
+  shard_pin (cluster);
+  lock_release (&shard->lock);
+
+  cache_flush_around (buffer);
+  cache_unpin (buffer);
 }
+
+/* Write-behind daemon.  Every CACHE_FLUSH_SLICE it writes back the buffers
+   that have been delayed write for cache_dirty_age ms.  When more than
+   cache_dirty_ratio percent of the cache is dirty, it writes back the
+   oldest buffers regardless of their age until half of that is left; it
+   is woken at once by buffer_set_delayed then, without waiting for the
+   slice to end.  The running journal transaction is committed first, so
+   the metadata it changed can be written too. */
 void cache_flush_task (void *AUX UNUSED)
 {
+  int64_t age;
+
   for (;;) {
-    timer_sleep (TIMER_FREQ); // sleep one second
-    cache_flush_cache ();
+    sema_down (&sema_flush);
+    lock_acquire (&lock_dirty);
+    flush_due = false;
+    lock_release (&lock_dirty);
+    journal_tick ();
+    if (dirty_cnt * 100 > cache_dirty_ratio * cache_size) {
+      CDEBUG ("***** %d dirty buffers, flush early.\n", dirty_cnt);
+      while (dirty_cnt * 200 > cache_dirty_ratio * cache_size
+	     && cache_writeback (0) > 0)
+	continue;
+    }
+    age = (int64_t) cache_dirty_age * TIMER_FREQ / 1000;
+    while (cache_writeback (age) == CACHE_WB_BATCH)
+      continue;
   }
 }
 
-void cache_flush_cache (void)
+/* Wake the write-behind daemon every CACHE_FLUSH_SLICE, unless it is
+   due already. */
+static void cache_tick_task (void *AUX UNUSED)
 {
+  for (;;) {
+    timer_sleep (CACHE_FLUSH_SLICE);
+    lock_acquire (&lock_dirty);
+    if (!flush_due) {
+      flush_due = true;
+      sema_up (&sema_flush);
+    }
+    lock_release (&lock_dirty);
+  }
+}
+
+/* Order buffers by sector. */
+static int
+cache_sector_cmp (const void *a_, const void *b_)
+{
+  const struct cache_entry *a = *(struct cache_entry * const *) a_;
+  const struct cache_entry *b = *(struct cache_entry * const *) b_;
+
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Write back up to CACHE_WB_BATCH of the buffers that have been delayed
+   write for at least AGE ticks, oldest first.  The batch is written like an
+   elevator sweeping up the disk: sorted by sector, starting from where the
+   last write ended and wrapping around to the lowest sector, and each run of
+   adjacent delayed write sectors goes in a single request, taking along
+   the dirty neighbours in the cluster that are not in the batch.  The
+   buffers are pinned while the dirty list is locked and written after it is
+   released; no shard stays locked during the disk writes, so lookups go
+   on.  Returns the number of buffers in the batch. */
+static int cache_writeback (int64_t age)
+{
+  struct cache_entry *batch[CACHE_WB_BATCH];
   struct cache_entry *buffer;
-  struct hash_iterator i;
-
-  CDEBUG ("***** wake up after 0.2 second.\n");
-  lock_acquire (&lock_buffercache);
-  hash_first (&i, &buffer_cache);
-  while (hash_next (&i)) {
-    buffer = hash_entry (hash_cur (&i), struct cache_entry, hash_elem);
-    if (buffer != NULL && buffer_is_delayed(buffer)) {
-      acquire_shared (&buffer->lock_shared);
-      cache_flush_buffer (buffer);
-      release_shared (&buffer->lock_shared);
-      CDEBUG ("daemon-flush: buffer[%d] to %s[%d].\n", buffer->seq,
-	      block_type_name(block_type(fs_device)), buffer->sector);
+  struct list_elem *e;
+  int64_t now = timer_ticks ();
+  int cnt = 0, start, i;
+
+  lock_acquire (&lock_dirty);
+  for (e = list_begin (&list_dirty);
+       e != list_end (&list_dirty) && cnt < CACHE_WB_BATCH;
+       e = list_next (e)) {
+    buffer = list_entry (e, struct cache_entry, dirty_elem);
+    if (now - buffer->dirty_time < age)
+      break;                  // the rest became dirty even later
+    if (journal_pending (buffer))
+      continue;               // written once its transaction commits
+    lock_acquire (&buffer->cluster->shard->lock);
+    shard_pin (buffer->cluster);
+    lock_release (&buffer->cluster->shard->lock);
+    batch[cnt++] = buffer;
+  }
+  lock_release (&lock_dirty);
+
+  qsort (batch, cnt, sizeof *batch, cache_sector_cmp);
+  for (start = 0; start < cnt && batch[start]->sector < wb_head; start++)
+    continue;
+  for (i = 0; i < cnt; i++) {
+    buffer = batch[(start + i) % cnt];
+    cache_flush_around (buffer);
+    cache_unpin (buffer);
+  }
+  return cnt;
+}
+
+/* Write all delayed write buffers to disk. */
+void cache_flush_cache (void)
+{
+  while (cache_writeback (0) > 0)
+    continue;
+}
+
+/* Shrink the buffer cache by a cluster for the frame allocator, which has
+   run out of user frames.  The clean sectors of the cluster are dropped from
+   the cache.  Return the page of the cluster, or NULL if no shard has an
+   idle cluster to spare; a shard keeps CACHE_SHARD_MIN clusters at least. */
+void *cache_shrink (void)
+{
+  static int next;                    /* shard to shrink next */
+  struct cache_shard *shard;
+  struct cache_cluster *cluster;
+  struct list_elem *e;
+  void *kpage;
+  int i;
+
+  for (i = 0; i < shard_cnt; i++) {
+    shard = &shards[(next + i) % shard_cnt];
+    lock_acquire (&shard->lock);
+    for (e = list_begin (&shard->owned); shard->capacity > CACHE_SHARD_MIN
+	   && e != list_end (&shard->owned); e = list_next (e)) {
+      cluster = list_entry (e, struct cache_cluster, elem);
+      if (cluster->pin_cnt > 0 || cluster_is_delayed (cluster)
+	  || cluster->sector <= ROOT_DIR_SECTOR)
+	continue;
+
+      if (shard_find (shard, cluster->sector) == cluster) {
+	cache_policy->remove (shard, cluster);
+	hash_delete (&shard->clusters, &cluster->hash_elem);
+	cluster_evicted (cluster);
+      } else {
+	list_remove (&cluster->list_elem);
+      }
+      list_remove (&cluster->elem);
+      shard->capacity--;
+      if (shard->target > shard->capacity)
+	shard->target = shard->capacity;
+      cache_size -= CACHE_CLUSTER_SECTORS;
+      lock_release (&shard->lock);
+
+      next = (next + i + 1) % shard_cnt;
+      kpage = cluster->kpage;
+      free (cluster);
+      CDEBUG ("cache-shrink: %d buffers left.\n", cache_size);
+      return kpage;
     }
+    lock_release (&shard->lock);
   }
-  lock_release (&lock_buffercache);
+  return NULL;
 }
 
-/*
-//block read ahead
+/* Copy the statistics of the buffer cache to *ST. */
+void cache_get_stats (struct fsstat *st)
+{
+  *st = stats;
+  st->cache_size = cache_size;
+}
+
+/* Print statistics of the buffer cache. */
+void cache_print_stats (void)
+{
+  static const char *class_names[] = {"metadata", "data"};
+  int i;
 
-static struct cache_entry 
-*breada (struct block *block, block_sector_t sector, block_sector_t sector_next)
+  printf ("Buffer cache (%s): %d sectors, %llu reads of %llu sectors, "
+	  "%llu writes of %llu sectors\n", cache_policy->name, cache_size,
+	  stats.read_requests, stats.read_sectors,
+	  stats.write_requests, stats.write_sectors);
+  for (i = CACHE_META; i <= CACHE_DATA; i++) {
+    printf ("Buffer cache %s: %llu hits, %llu misses, %llu evictions, "
+	    "%llu writebacks\n", class_names[i], stats.hits[i],
+	    stats.misses[i], stats.evictions[i], stats.writebacks[i]);
+    printf ("Buffer cache %s: %llu read-ahead hits, %llu wasted, "
+	    "%llu lock waits in %llu ticks\n", class_names[i],
+	    stats.ra_hits[i], stats.ra_wasted[i],
+	    stats.lock_waits[i], stats.lock_wait_ticks[i]);
+  }
+}
+
+/* Queue SECTOR to be read into the cache by the read-ahead thread, so a
+   later cache_block_read of it does not wait for the disk.  The request is
+   dropped if the sector is cached already or the queue is full. */
+void cache_readahead (block_sector_t sector, enum cache_class class)
 {
-  struct cache_entry *buffer1, *buffer2;
+  struct readahead *ra;
+
+  if (cache_is_cached (sector, NULL))
+    return;
 
-  buffer1 = cache_lookup (sector);
-  if (buffer1 == NULL) {
-    buffer1 = bread (block, sector);
+  lock_acquire (&lock_readahead);
+  if (ra_cnt < CACHE_RA_QUEUE) {
+    ra = &ra_queue[(ra_head + ra_cnt++) % CACHE_RA_QUEUE];
+    ra->sector = sector;
+    ra->class = class;
+    sema_up (&sema_readahead);
   }
-  buffer2 = cache_lookup (sector_next);
-  if (buffer2 == NULL) {
-    buffer2 = bread (block, sector_next);
-    cache_release (buffer2);
+  lock_release (&lock_readahead);
+}
+
+/* Read the queued sectors in the background. */
+void cache_readahead_task (void *AUX UNUSED)
+{
+  struct readahead ra;
+
+  for (;;) {
+    sema_down (&sema_readahead);
+    lock_acquire (&lock_readahead);
+    ra = ra_queue[ra_head];
+    ra_head = (ra_head + 1) % CACHE_RA_QUEUE;
+    ra_cnt--;
+    lock_release (&lock_readahead);
+
+    cache_prefetch (ra.sector, ra.class);
   }
-  return buffer1; 
 }
-*/
 
-void cache_block_read (struct block *block, block_sector_t sector, void *data)
+/* Read SECTOR, which holds CLASS of data, into the cache without copying it
+   anywhere. */
+static void cache_prefetch (block_sector_t sector, enum cache_class class)
 {
   struct cache_entry *buffer;
-  enum intr_level old_level;
-
-  buffer = cache_get_block(sector);
-  if (buffer->sector != sector) {
-    buffer->sector = sector;
-    lock_acquire (&lock_buffercache);
-    hash_insert (&buffer_cache, &buffer->hash_elem);
-    lock_release (&lock_buffercache);
-    //initiate disk read
-    block_read (block, sector, buffer->data);
-  }  
-  /* Before copying data from cache to memory, change the lock to shared mode
-     to allow parallelism
-  */
-  old_level = intr_disable ();
+
+  buffer = cache_get (sector, class, true);
+  if (!buffer_is_valid (buffer)) {
+    buffer->class = class;
+    cache_load (buffer);
+    buffer->prefetched = true;
+    CDEBUG ("cache-readahead: buffer[%d] from %s[%d].\n", buffer->seq,
+	    block_type_name(block_type(fs_device)), sector);
+  }
   cache_release (buffer);
-  acquire_shared (&buffer->lock_shared);
-  intr_set_level (old_level);
+}
 
-  memcpy (data, buffer->data, BLOCK_SECTOR_SIZE);
-  //data = buffer->data;
-  release_shared (&buffer->lock_shared);
+/* Lock BUFFER exclusively for cache_load if it is not valid and nobody
+   holds it.  Return true if it is locked. */
+static bool
+cache_claim (struct cache_entry *buffer)
+{
+  if (buffer_is_valid (buffer)
+      || buffer->sector >= block_size (fs_device)
+      || !try_acquire_exclusive (&buffer->lock_shared))
+    return false;
+  if (buffer_is_valid (buffer)) {
+    release_exclusive (&buffer->lock_shared);
+    return false;
+  }
+  return true;
+}
+
+/* Read BUFFER, which is locked exclusively and not valid, from disk.  The
+   buffers around it in its cluster that are not valid either and that
+   nobody holds are read along with it by a single request; they count as
+   read ahead, holding the same class of data as BUFFER. */
+static void cache_load (struct cache_entry *buffer)
+{
+  struct cache_entry *buffers = buffer->cluster->buffers;
+  int idx = buffer - buffers;
+  int first = idx, last = idx, i;
+
+  while (first > 0 && cache_claim (&buffers[first - 1]))
+    first--;
+  while (last + 1 < CACHE_CLUSTER_SECTORS && cache_claim (&buffers[last + 1]))
+    last++;
+
+  //initiate disk read
+  block_read_sectors (fs_device, buffers[first].sector, buffers[first].data,
+		      last - first + 1);
+  stats.read_requests++;
+  stats.read_sectors += last - first + 1;
+  for (i = first; i <= last; i++) {
+    buffer_set_valid (&buffers[i], true);
+    if (i != idx) {
+      buffers[i].class = buffer->class;
+      buffers[i].prefetched = true;
+      release_exclusive (&buffers[i].lock_shared);
+    }
+  }
+}
+
+/* Return true if SECTOR is in the buffer cache, and if PREFETCHED is
+   not null, store in it whether the sector was read ahead and not used
+   since.  The answer is looked up under the shard lock, since the cluster
+   may be reassigned or freed by cache_shrink as soon as the lock is
+   released. */
+bool cache_is_cached (block_sector_t sector, bool *prefetched)
+{
+  struct cache_shard *shard = cache_shard (sector);
+  struct cache_cluster *cluster;
+  struct cache_entry *buffer;
+  bool cached;
+
+  lock_acquire (&shard->lock);
+  cluster = shard_find (shard, cluster_first (sector));
+  buffer = (cluster != NULL
+	    ? &cluster->buffers[sector % CACHE_CLUSTER_SECTORS] : NULL);
+  cached = buffer != NULL && buffer_is_valid (buffer);
+  if (prefetched != NULL)
+    *prefetched = cached && buffer->prefetched;
+  lock_release (&shard->lock);
+  return cached;
+}
+
+/* Return true if SECTOR is in the buffer cache and delayed write. */
+bool cache_is_delayed (block_sector_t sector)
+{
+  struct cache_shard *shard = cache_shard (sector);
+  struct cache_cluster *cluster;
+  bool delayed;
+
+  lock_acquire (&shard->lock);
+  cluster = shard_find (shard, cluster_first (sector));
+  delayed = (cluster != NULL
+	     && buffer_is_delayed (&cluster->buffers[sector
+						     % CACHE_CLUSTER_SECTORS]));
+  lock_release (&shard->lock);
+  return delayed;
+}
+
+void cache_block_read (struct block *block UNUSED, block_sector_t sector,
+		       void *data, enum cache_class class)
+{
+  struct cache_entry *buffer;
+  const void *cached = cache_read_get (sector, class, &buffer);
+
+  memcpy (data, cached, BLOCK_SECTOR_SIZE);
+  cache_read_put (buffer);
 
   CDEBUG ("cache-read: buffer[%d] from %s[%d].\n", buffer->seq,
   	  block_type_name(block_type(block)), sector);
 }
 
 void cache_block_write (struct block *block UNUSED, block_sector_t sector,
-			const void *data)
+			const void *data, enum cache_class class)
+{
+  cache_block_write_at (sector, data, 0, BLOCK_SECTOR_SIZE, false, class);
+}
+
+/* Return the buffer of SECTOR locked exclusively for a write of SIZE bytes
+   at byte OFS, valid around them; see cache_block_write_at. */
+static struct cache_entry *
+cache_get_write (block_sector_t sector, int ofs, int size, bool fresh,
+		 enum cache_class class)
 {
   struct cache_entry *buffer;
-  buffer = cache_get_block (sector);
-  buffer->sector = sector;
-  CDEBUG ("cache-write: buffer[%d] to %s[%d].\n", buffer->seq, 
-  	  block_type_name(block_type(block)), sector);
-  memcpy (&buffer->data, data, BLOCK_SECTOR_SIZE);
-
-  if (buffer != NULL && buffer->sector != (block_sector_t) -1 ) {
-    lock_acquire (&lock_buffercache);
-    hash_insert (&buffer_cache, &buffer->hash_elem);
-    lock_release (&lock_buffercache);
-    buffer_set_delayed (buffer, true);
-    cache_release (buffer);
+  bool whole = ofs == 0 && size == BLOCK_SECTOR_SIZE;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  buffer = cache_get_block (sector, class);
+  if (fresh && !whole) {
+    // a cached copy may still hold the data of a file that freed the sector
+    memset (buffer->data, 0, BLOCK_SECTOR_SIZE);
+    buffer_set_valid (buffer, true);
+  } else if (!buffer_is_valid (buffer)) {
+    if (!whole)
+      cache_load (buffer);
+    else
+      buffer_set_valid (buffer, true);
   }
+  return buffer;
+}
+
+/* Write SIZE bytes of DATA, or zeros if DATA is a null pointer, to byte OFS
+   of SECTOR in place in the buffer cache.  The rest of the sector is read
+   from disk first only if it is not cached and may hold data: not for a
+   whole sector, nor if FRESH says the sector is known to be all zeros,
+   because it was just allocated or lies wholly past the end of its file.
+   The rest of a FRESH sector is cleared even if it is cached, so FRESH must
+   only be passed for the first write to the sector past the end of file. */
+void cache_block_write_at (block_sector_t sector, const void *data,
+			   int ofs, int size, bool fresh,
+			   enum cache_class class)
+{
+  struct cache_entry *buffer;
+
+  buffer = cache_get_write (sector, ofs, size, fresh, class);
+  CDEBUG ("cache-write: buffer[%d] to %s[%d], %d bytes at %d.\n", buffer->seq,
+  	  block_type_name(block_type(fs_device)), sector, size, ofs);
+  if (data != NULL)
+    memcpy ((uint8_t *) buffer->data + ofs, data, size);
+  else
+    memset ((uint8_t *) buffer->data + ofs, 0, size);
+  buffer_set_delayed (buffer, true);
+  cache_release (buffer);
+}
+
+/* Copy SIZE bytes at byte SRC_OFS of sector SRC to byte DST_OFS of sector
+   DST in place in the buffer cache, from one buffer straight into the
+   other.  FRESH and CLASS are as for cache_block_write_at of DST.  The two
+   buffers are locked in the order of their sectors, so that copies in
+   opposite directions cannot deadlock. */
+void cache_block_copy (block_sector_t dst, int dst_ofs, block_sector_t src,
+		       int src_ofs, int size, bool fresh,
+		       enum cache_class class)
+{
+  struct cache_entry *from = NULL, *to;
+  const uint8_t *data = NULL;
+
+  ASSERT (dst != src);
+  ASSERT (src_ofs >= 0 && src_ofs + size <= BLOCK_SECTOR_SIZE);
+
+  if (src < dst)
+    data = cache_read_get (src, class, &from);
+  to = cache_get_write (dst, dst_ofs, size, fresh, class);
+  if (from == NULL)
+    data = cache_read_get (src, class, &from);
+  memcpy ((uint8_t *) to->data + dst_ofs, data + src_ofs, size);
+  cache_read_put (from);
+  buffer_set_delayed (to, true);
+  cache_release (to);
+}
+
+/* Read SECTOR into the cache if necessary and return a pointer to its data
+   in the cache.  The buffer stays pinned and locked in shared mode, so the
+   data cannot change or be evicted until it is returned by cache_read_put.
+   The buffer to return is stored in *BUFP. */
+const void *cache_read_get (block_sector_t sector, enum cache_class class,
+			    struct cache_entry **bufp)
+{
+  struct cache_entry *buffer;
+
+  buffer = cache_get_block (sector, class);
+  if (!buffer_is_valid (buffer))
+    cache_load (buffer);
+  /* Change the lock to shared mode to allow parallel readers */
+  downgrade_exclusive (&buffer->lock_shared);
+  *bufp = buffer;
+  return buffer->data;
+}
+
+/* Return a buffer obtained from cache_read_get. */
+void cache_read_put (struct cache_entry *buffer)
+{
+  release_shared (&buffer->lock_shared);
+  cache_unpin (buffer);
+}
+
+/* Read SECTOR into the cache if necessary and return a pointer to its data
+   in the cache for modification in place.  The buffer stays pinned and
+   locked in exclusive mode until it is returned by cache_write_put.
+   The buffer to return is stored in *BUFP. */
+void *cache_write_get (block_sector_t sector, enum cache_class class,
+		       struct cache_entry **bufp)
+{
+  struct cache_entry *buffer;
+
+  buffer = cache_get_block (sector, class);
+  if (!buffer_is_valid (buffer))
+    cache_load (buffer);
+  *bufp = buffer;
+  return buffer->data;
+}
+
+/* Return a buffer obtained from cache_write_get and mark it delayed write. */
+void cache_write_put (struct cache_entry *buffer)
+{
+  buffer_set_delayed (buffer, true);
+  cache_release (buffer);
 }
 
 bool buffer_is_delayed (struct cache_entry *buffer)
@@ -287,12 +999,31 @@ bool buffer_is_delayed (struct cache_entry *buffer)
   return buffer->status & CACHE_DELAYED;
 }  
 
+/* Mark or clear delayed write, keeping the buffer on the dirty list while
+   it is delayed write, and waking the write-behind daemon when more than
+   cache_dirty_ratio percent of the cache is dirty.  A change of metadata
+   joins the running journal transaction. */
 void buffer_set_delayed (struct cache_entry *buffer, bool flag)
 {
-  if (flag)
+  if (flag && buffer->class == CACHE_META)
+    journal_add (buffer);
+  lock_acquire (&lock_dirty);
+  if (flag && !buffer_is_delayed (buffer)) {
     buffer->status |=  CACHE_DELAYED;
-  else
+    buffer->dirty_time = timer_ticks ();
+    list_push_back (&list_dirty, &buffer->dirty_elem);
+    dirty_cnt++;
+    if (dirty_cnt * 100 > cache_dirty_ratio * cache_size && !flush_due) {
+      // too dirty to wait for the next slice
+      flush_due = true;
+      sema_up (&sema_flush);
+    }
+  } else if (!flag && buffer_is_delayed (buffer)) {
     buffer->status &= ~CACHE_DELAYED;
+    list_remove (&buffer->dirty_elem);
+    dirty_cnt--;
+  }
+  lock_release (&lock_dirty);
 }  
 
 bool buffer_is_busy (struct cache_entry *buffer)
@@ -307,6 +1038,18 @@ void buffer_set_busy (struct cache_entry *buffer, bool flag)
     buffer->status &= ~CACHE_BUSY;
 }  
 
+bool buffer_is_valid (struct cache_entry *buffer)
+{
+  return buffer->status & CACHE_VALID;
+}  
+void buffer_set_valid (struct cache_entry *buffer, bool flag)
+{
+  if (flag)
+    buffer->status |=  CACHE_VALID;
+  else
+    buffer->status &= ~CACHE_VALID;
+}  
+
 void init_shared (struct shared_lock *s)
 {
   s->i = 0;
@@ -340,6 +1083,36 @@ acquire_exclusive (struct shared_lock *s)
   lock_release (&s->lock);
 }
 
+/* Acquire lock in shared mode if it can be done without waiting.  Return
+   true if it is acquired. */
+bool
+try_acquire_shared (struct shared_lock *s)
+{
+  bool success;
+
+  lock_acquire (&s->lock);
+  success = s->i >= 0;
+  if (success)
+    s->i ++;
+  lock_release (&s->lock);
+  return success;
+}
+
+/* Acquire lock in exclusive mode if it can be done without waiting.
+   Return true if it is acquired. */
+bool
+try_acquire_exclusive (struct shared_lock *s)
+{
+  bool success;
+
+  lock_acquire (&s->lock);
+  success = s->i == 0;
+  if (success)
+    s->i = -1;
+  lock_release (&s->lock);
+  return success;
+}
+
 /* Release lock in shared mode */
 void 
 release_shared (struct shared_lock *s)
@@ -359,3 +1132,14 @@ release_exclusive (struct shared_lock *s)
   cond_broadcast (&s->cond, &s->lock);
   lock_release (&s->lock);
 }
+
+/* Change lock held in exclusive mode to shared mode without letting any
+   writer in between */
+void
+downgrade_exclusive (struct shared_lock *s)
+{
+  lock_acquire (&s->lock);
+  s->i = 1;
+  cond_broadcast (&s->cond, &s->lock);
+  lock_release (&s->lock);
+}
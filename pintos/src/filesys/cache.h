@@ -7,16 +7,33 @@
 #include <user/syscall.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 #define CACHE_ON false
 #define CDEBUG  if (CACHE_ON) printf
 
-#define BUFFER_CACHE_SIZE 64
+#define BUFFER_CACHE_SIZE 64 /* default number of buffers */
+#define CACHE_CLUSTER_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE) /* page of sectors */
+#define CACHE_SHARD_CNT 8  /* max number of independently locked shards */
+#define CACHE_SHARD_MIN 4  /* min number of clusters in a shard */
+#define CACHE_RA_QUEUE 64  /* max sectors waiting to be read ahead */
+#define CACHE_WB_BATCH 64  /* max buffers sorted and written in one batch */
+#define CACHE_FLUSH_SLICE (TIMER_FREQ / 10) /* flusher checks every 0.1 s */
+#define CACHE_CORRELATED (TIMER_FREQ / 20) /* uses this close are one use */
 #define CACHE_DELAYED 0x1  /* the buffer is delayed write */
 #define CACHE_BUSY    0x2  /* the buffer is selected to be r/w, cannot evict */
 //#define CACHE_FLUSH   0x4  /* the buffer is flushing */
 //#define CACHE_WAIT    0x8  /* the buffer is requested by other processes */
+#define CACHE_VALID   0x10 /* the buffer holds the data of its sector */
+/* Kind of sectors, the statistics are kept separately for each. */
+enum cache_class
+  {
+    CACHE_META = FSSTAT_META,  /* inodes, index blocks, directories... */
+    CACHE_DATA = FSSTAT_DATA   /* contents of regular files */
+  };
+
 struct shared_lock
 {
   int i;
@@ -24,39 +41,153 @@ struct shared_lock
   struct condition cond;
 };
 
+/* The buffer cache is split into up to CACHE_SHARD_CNT shards.  A sector
+   always maps to the same shard, and every shard owns a fixed subset of the
+   clusters, so lookups of sectors in different shards never contend.
+   The clusters holding sectors are ordered on the queues by the
+   replacement policy; see cache-policy.c. */
+struct cache_shard
+{
+  struct hash clusters;       /* clusters of the shard keyed by sector */
+  struct list owned;          /* all clusters owned by the shard */
+  struct list list_free;      /* clusters holding no sector */
+  struct list queues[2];      /* clusters holding sectors, policy order */
+  int queue_len[2];           /* number of clusters on each queue */
+  struct hash ghosts;         /* clusters evicted lately, keyed by sector */
+  struct list ghost_queues[2];/* ghosts, oldest first */
+  int ghost_len[2];           /* number of ghosts on each ghost queue */
+  struct list ghost_free;     /* unused ghosts */
+  int capacity;               /* number of clusters owned by the shard */
+  int target;                 /* ARC: target length of queues[0] */
+  struct list_elem *hand;     /* CLOCK: next cluster to examine */
+  struct semaphore sema_lru;  /* event to indicate a cluster may be free */
+  struct lock lock;           /* lock when accessing the fields above */
+};
+
+/* A cluster evicted from a shard lately, remembered by 2Q and ARC. */
+struct cache_ghost
+{
+  block_sector_t sector;      /* first sector of the cluster, hash key */
+  int queue;                  /* index of the ghost queue it is on */
+  struct hash_elem hash_elem; /* An element in the shard's ghosts */
+  struct list_elem list_elem; /* Member in a ghost queue or ghost_free */
+};
+
+/* The buffer of a single sector.  It is locked, loaded and written back
+   on its own, but is cached and evicted together with its cluster. */
 struct cache_entry
 {
   int seq;                    /* sequence of the cache entry */
-  struct hash_elem hash_elem; /* An element in the buffer_cache hash table */
-  struct list_elem list_elem; /* Member in lru list */
-  block_sector_t sector;      /* Data block number, the key of hash table */
+  block_sector_t sector;      /* Data block number */
   int  status;                /* Status of the cache entry */
+  struct cache_cluster *cluster; /* the cluster holding this buffer */
+  enum cache_class class;     /* kind of the sector, for the statistics */
+  bool prefetched;            /* read ahead and not used since */
+  struct list_elem dirty_elem;/* Member in dirty list if delayed write */
+  int64_t dirty_time;         /* timer ticks when it became delayed write */
+  unsigned jseq;              /* last journal transaction that changed it */
   struct semaphore sema_buf;  /* event to indicate this buffer is available */
   struct shared_lock lock_shared;/*monitor for multiple readers and one writer*/
-  char data[BLOCK_SECTOR_SIZE]; /* Actual data read from the block */
+  void *data;                 /* Actual data read from the block */
+};
+
+/* CACHE_CLUSTER_SECTORS consecutive sectors starting at a multiple of
+   CACHE_CLUSTER_SECTORS, the unit the buffer cache looks up and evicts.
+   The data of its buffers is a page of the user pool, so adjacent sectors
+   are read and written with a single disk request, and the buffer cache
+   gives the page to the frame allocator when the cluster is idle. */
+struct cache_cluster
+{
+  int seq;                    /* sequence of the cluster */
+  struct hash_elem hash_elem; /* An element in the shard's hash table */
+  struct list_elem list_elem; /* Member in a policy queue or list_free */
+  struct list_elem elem;      /* Member in the shard's owned */
+  block_sector_t sector;      /* first sector, the key of hash table */
+  int pin_cnt;                /* number of users, evictable only when 0 */
+  struct cache_shard *shard;  /* the shard owning this cluster */
+  int queue;                  /* index of the policy queue it is on */
+  bool referenced;            /* CLOCK: used since the hand passed by */
+  block_sector_t last_sector; /* sector looked up last */
+  int64_t use_time;           /* timer ticks of the last use counted */
+  void *kpage;                /* the page holding the data */
+  struct cache_entry buffers[CACHE_CLUSTER_SECTORS]; /* the buffers */
+};
+
+/* Replacement policy of the buffer cache.  All functions are called with
+   the shard locked.  A cluster enters the policy by insert after it is
+   assigned new sectors, is passed to hit on every later use that is not
+   correlated to an earlier one (see cache_get), and leaves by remove
+   when victim has chosen it for eviction.  victim must only choose
+   clusters whose pin_cnt is 0, or return NULL if there are none; SECTOR
+   is the first sector that is going to be cached. */
+struct cache_policy
+{
+  const char *name;
+  void (*init) (struct cache_shard *);
+  void (*hit) (struct cache_shard *, struct cache_cluster *);
+  void (*insert) (struct cache_shard *, struct cache_cluster *);
+  void (*remove) (struct cache_shard *, struct cache_cluster *);
+  struct cache_cluster *(*victim) (struct cache_shard *,
+				   block_sector_t sector);
 };
 
+/* Policy in use, selected by the -cache-policy option. */
+extern const struct cache_policy *cache_policy;
+bool cache_policy_select (const char *name);
+void cache_ghost_init (struct cache_shard *, struct cache_ghost *, int cnt);
+
+/* Number of buffers, set by the -cache-size option. */
+extern int cache_size;
+
+/* Write-behind tuning, set by the -cache-age and -cache-dirty options. */
+extern int cache_dirty_age;   /* write back buffers dirty this many ms */
+extern int cache_dirty_ratio; /* flush early above this percent dirty */
+
 unsigned cache_hash_value (const struct hash_elem *ce, void *aux UNUSED);
 bool cache_hash_less (const struct hash_elem *a, const struct hash_elem *b,
 		      void *aux UNUSED);
-struct cache_entry *cache_lookup (block_sector_t sector);
 
 void cache_init (void);
-struct cache_entry *cache_get_block (block_sector_t sector);
+struct cache_entry *cache_get_block (block_sector_t sector,
+				     enum cache_class class);
 void cache_release (struct cache_entry *cache);
+void cache_unpin (struct cache_entry *buffer);
 void cache_lock (struct cache_entry *ce);
 void cache_unlock (struct cache_entry *ce);
 void cache_evict (void);
 void cache_flush_buffer (struct cache_entry *buffer);
+void cache_flush_block (block_sector_t sector);
 void cache_flush_cache (void);
+void cache_get_stats (struct fsstat *stats);
+void cache_print_stats (void);
+void *cache_shrink (void);
 void cache_flush_task (void *AUX UNUSED);
-void cache_block_read (struct block *block, block_sector_t sector, void *data);
+void cache_readahead (block_sector_t sector, enum cache_class class);
+void cache_readahead_task (void *AUX UNUSED);
+bool cache_is_cached (block_sector_t sector, bool *prefetched);
+bool cache_is_delayed (block_sector_t sector);
+void cache_block_read (struct block *block, block_sector_t sector, void *data,
+		       enum cache_class class);
 void cache_block_write (struct block *block, block_sector_t sector,
-			const void *data);
+			const void *data, enum cache_class class);
+void cache_block_write_at (block_sector_t sector, const void *data,
+			   int ofs, int size, bool fresh,
+			   enum cache_class class);
+void cache_block_copy (block_sector_t dst, int dst_ofs, block_sector_t src,
+		       int src_ofs, int size, bool fresh,
+		       enum cache_class class);
+const void *cache_read_get (block_sector_t sector, enum cache_class class,
+			    struct cache_entry **bufp);
+void cache_read_put (struct cache_entry *buffer);
+void *cache_write_get (block_sector_t sector, enum cache_class class,
+		       struct cache_entry **bufp);
+void cache_write_put (struct cache_entry *buffer);
 bool buffer_is_delayed (struct cache_entry *buffer);
 void buffer_set_delayed (struct cache_entry *buffer, bool flag);
 bool buffer_is_busy (struct cache_entry *buffer);
 void buffer_set_busy (struct cache_entry *buffer, bool flag);
+bool buffer_is_valid (struct cache_entry *buffer);
+void buffer_set_valid (struct cache_entry *buffer, bool flag);
 
 /*
 Readers-Writers Problem
@@ -73,7 +204,10 @@ Readers-Writers Problem
 void init_shared (struct shared_lock *s);
 void acquire_shared (struct shared_lock *s);
 void acquire_exclusive (struct shared_lock *s);
+bool try_acquire_shared (struct shared_lock *s);
+bool try_acquire_exclusive (struct shared_lock *s);
 void release_shared (struct shared_lock *s);
 void release_exclusive (struct shared_lock *s);
+void downgrade_exclusive (struct shared_lock *s);
 
 #endif /* filesys/cache.h */
@@ -0,0 +1,151 @@
+/* pintos/src/filesys/dcache.c
+   Dentry cache: remembers which inode a name in a directory refers to,
+   or that the directory has no such name, so that resolving the same
+   path again needs no directory lookup.  dir_lookup fills it, dir_add and
+   dir_remove keep it up to date.  The least recently used name is
+   forgotten to make room for a new one.
+*/
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* NAME in the directory whose inode is in sector DIR refers to the inode
+   in sector SECTOR, or to no file if SECTOR is BLOCK_ERROR. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;    /* Element in dentries. */
+    struct list_elem list_elem;    /* Element in lru or list_free. */
+    block_sector_t dir;            /* Sector of the directory. */
+    char name[NAME_MAX + 1];       /* Name in the directory. */
+    block_sector_t sector;         /* Sector of the inode, the result. */
+  };
+
+static struct dcache_entry entries[DCACHE_SIZE];
+static struct hash dentries;       /* entries keyed by DIR and NAME */
+static struct list lru;            /* entries in use, most recent first */
+static struct list list_free;      /* entries not in use */
+static struct lock lock_dcache;    /* lock when accessing the above */
+
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry,
+					     hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+	     void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+					     hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+					     hash_elem);
+  return a->dir != b->dir ? a->dir < b->dir : strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  int i;
+
+  hash_init (&dentries, dcache_hash, dcache_less, NULL);
+  list_init (&lru);
+  list_init (&list_free);
+  lock_init (&lock_dcache);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&list_free, &entries[i].list_elem);
+}
+
+/* Returns the entry of NAME in DIR, or a null pointer if there is none.
+   The cache must be locked. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in sector DIR.  Returns true if the
+   cache knows, storing the sector of the inode NAME refers to into
+   *SECTOR, or BLOCK_ERROR if DIR has no file NAME. */
+bool
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sector)
+{
+  struct dcache_entry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+  lock_acquire (&lock_dcache);
+  d = dcache_find (dir, name);
+  if (d != NULL) {
+    list_remove (&d->list_elem);
+    list_push_front (&lru, &d->list_elem);
+    *sector = d->sector;
+  }
+  lock_release (&lock_dcache);
+  return d != NULL;
+}
+
+/* Remembers that NAME in the directory in sector DIR refers to the inode
+   in SECTOR, or to no file if SECTOR is BLOCK_ERROR. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dcache_entry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&lock_dcache);
+  d = dcache_find (dir, name);
+  if (d != NULL)
+    list_remove (&d->list_elem);
+  else {
+    if (!list_empty (&list_free))
+      d = list_entry (list_pop_front (&list_free), struct dcache_entry,
+		      list_elem);
+    else {
+      d = list_entry (list_pop_back (&lru), struct dcache_entry, list_elem);
+      hash_delete (&dentries, &d->hash_elem);
+    }
+    d->dir = dir;
+    strlcpy (d->name, name, sizeof d->name);
+    hash_insert (&dentries, &d->hash_elem);
+  }
+  d->sector = sector;
+  list_push_front (&lru, &d->list_elem);
+  lock_release (&lock_dcache);
+}
+
+/* Forgets all the names in the directory in sector DIR, which is being
+   removed, so its sector may hold another directory later. */
+void
+dcache_purge_dir (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+  struct dcache_entry *d;
+
+  lock_acquire (&lock_dcache);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next) {
+    next = list_next (e);
+    d = list_entry (e, struct dcache_entry, list_elem);
+    if (d->dir == dir) {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->list_elem);
+      list_push_back (&list_free, &d->list_elem);
+    }
+  }
+  lock_release (&lock_dcache);
+}
@@ -0,0 +1,16 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+#define DCACHE_SIZE 256  /* number of names remembered */
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+		    block_sector_t *sector);
+void dcache_insert (block_sector_t dir, const char *name,
+		    block_sector_t sector);
+void dcache_purge_dir (block_sector_t dir);
+
+#endif /* filesys/dcache.h */
@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -22,6 +24,38 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* The entries of a directory are searched and changed with its inode
+   locked by inode_lock, so that a name is added once, and a file is
+   not opened by name while it is being removed.  Directories are
+   locked one at a time, except that removing a directory locks its
+   parent, then itself to check it is empty. */
+
+/* A directory is scanned linearly until it has DIR_INDEX_MIN entry
+   slots, then it is indexed: its entries are hashed by name into
+   buckets of DIR_BUCKET_SLOTS slots. */
+#define DIR_INDEX_MIN 64
+#define DIR_BUCKET_SLOTS 16
+#define DIR_INDEX_MAGIC "\1idx"
+
+/* Header of an indexed directory.  It takes the place of the first entry
+   and looks like an entry not in use, so the code reading the entries
+   one after the other skips it.  The slots of the buckets follow.  A name
+   is stored in the first free slot from the start of its bucket on,
+   wrapping around at the end.  A slot never used has an empty name and
+   ends a search; an entry removed keeps its name, so that the search
+   goes on past it. */
+struct dir_index
+  {
+    uint32_t bucket_cnt;                /* Number of buckets. */
+    char magic[4];                      /* DIR_INDEX_MAGIC. */
+    uint32_t used_cnt;                  /* Slots in use or removed. */
+    char unused[7];
+    bool in_use;                        /* Always false. */
+  };
+
+static bool index_add (struct dir *, struct dir_index *,
+                       const struct dir_entry *);
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -102,6 +136,67 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Reads the header of DIR into *IDX.  Returns true if DIR is
+   indexed. */
+static bool
+index_read (const struct dir *dir, struct dir_index *idx)
+{
+  return (inode_read_at (dir->inode, idx, sizeof *idx, 0) == sizeof *idx
+          && !idx->in_use
+          && !memcmp (idx->magic, DIR_INDEX_MAGIC, sizeof idx->magic));
+}
+
+/* Returns the byte offset of slot SLOT of an indexed directory. */
+static off_t
+index_slot_ofs (size_t slot)
+{
+  return (slot + 1) * sizeof (struct dir_entry);
+}
+
+/* Searches DIR, which is indexed by IDX, for NAME.  Returns true and sets
+   *EP and *OFSP like lookup if found.  Otherwise sets *FREEP, if not
+   null, to the offset of the slot where NAME is to be added, or -1 if
+   all slots are in use, and *NEWP to true if the slot was never used. */
+static bool
+index_lookup (const struct dir *dir, const struct dir_index *idx,
+              const char *name, struct dir_entry *ep, off_t *ofsp,
+              off_t *freep, bool *newp)
+{
+  size_t slot_cnt = idx->bucket_cnt * DIR_BUCKET_SLOTS;
+  size_t first = hash_string (name) % idx->bucket_cnt * DIR_BUCKET_SLOTS;
+  struct dir_entry e;
+  off_t ofs, free_ofs = -1;
+  bool is_new = false;
+  size_t i;
+
+  for (i = 0; i < slot_cnt; i++)
+    {
+      ofs = index_slot_ofs ((first + i) % slot_cnt);
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        break;
+      if (e.in_use && !strcmp (name, e.name))
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          return true;
+        }
+      if (!e.in_use && free_ofs == -1)
+        {
+          free_ofs = ofs;
+          is_new = e.name[0] == '\0';
+        }
+      if (!e.in_use && e.name[0] == '\0')
+        break;
+    }
+  if (freep != NULL)
+    *freep = free_ofs;
+  if (newp != NULL)
+    *newp = is_new;
+  return false;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -112,42 +207,94 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  const struct dir_entry *cur;
+  const uint8_t *data = NULL;       /* Cached sector holding entries. */
+  struct cache_entry *buffer = NULL;
+  off_t data_ofs = 0;               /* Offset of that sector in DIR. */
+  off_t length, ofs, sector_ofs;
+  bool found = false;
   
+  struct dir_index idx;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  if (index_read (dir, &idx))
+    return index_lookup (dir, &idx, name, ep, ofsp, NULL, NULL);
+
+  /* Compare the entries in place in the buffer cache.  Only entries
+     straddling two sectors are copied out. */
+  length = inode_length (dir->inode);
+  for (ofs = 0; !found && ofs + (off_t) sizeof e <= length; ofs += sizeof e) 
+    {
+      sector_ofs = ofs % BLOCK_SECTOR_SIZE;
+      if (data != NULL && ofs - sector_ofs != data_ofs)
+        {
+          inode_read_put (buffer);
+          data = NULL;
+        }
+      if (sector_ofs + sizeof e > BLOCK_SECTOR_SIZE) 
+        {
+          if (data != NULL)
+            {
+              inode_read_put (buffer);
+              data = NULL;
+            }
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            break;
+          cur = &e;
+        }
+      else 
+        {
+          if (data == NULL)
+            {
+              data_ofs = ofs - sector_ofs;
+              data = inode_read_get (dir->inode, data_ofs, &buffer);
+              if (data == NULL)
+                break;
+            }
+          cur = (const struct dir_entry *) (data + sector_ofs);
+        }
+      if (cur->in_use && !strcmp (name, cur->name)) 
+        {
+          if (ep != NULL)
+            *ep = *cur;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          found = true;
+        }
+    }
+  if (data != NULL)
+    inode_read_put (buffer);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   The result is remembered by the dentry cache, so DIR is only
+   searched the first time. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
   off_t  offset;
+  block_sector_t dir_sector, sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, &offset))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, &offset) ? e.inode_sector : BLOCK_ERROR;
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != BLOCK_ERROR ? inode_open (sector) : NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -161,7 +308,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
-  struct dir_entry e;
+  struct dir_entry e, cur;
+  struct dir_index idx;
   off_t ofs;
   bool success = false;
 
@@ -172,29 +320,53 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  inode_lock (dir->inode);
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
+  memset (&e, 0, sizeof e);
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  if (index_read (dir, &idx))
+    {
+      success = index_add (dir, &idx, &e);
+      goto done;
+    }
+
+  /* Set OFS to offset of free slot, starting from the hint of the
+     inode, before which all slots are in use.
      If there are no free slots, then it will be set to the
      current end-of-file.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
+  for (ofs = inode_free_slot (dir->inode);
+       inode_read_at (dir->inode, &cur, sizeof cur, ofs) == sizeof cur;
+       ofs += sizeof cur) 
+    if (!cur.in_use)
       break;
 
+  /* A directory growing past DIR_INDEX_MIN slots is indexed. */
+  if (ofs >= inode_length (dir->inode)
+      && ofs / (off_t) sizeof e >= DIR_INDEX_MIN)
+    {
+      memset (&idx, 0, sizeof idx);
+      success = index_add (dir, &idx, &e);
+      goto done;
+    }
+
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    inode_set_free_slot (dir->inode, ofs + sizeof e);
 
  done:
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -213,6 +385,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -226,25 +399,32 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == dir_get_inode (t->cur_dir))
     goto done;
 
+  /* inode's open count > 0, cannot remove; checked first, so that nobody
+     else holds the directory locked below */
+  if (inode_is_dir (inode) && inode_open_cnt (inode) > 1)
+    goto done;
+
   /* inode is not empty directory, cannot remove */
   if (inode_is_dir (inode) && !dir_is_empty (inode))
     goto done;
-  
-  /* inode's open count > 0, cannot remove */
-  if (inode_is_dir (inode) && inode_open_cnt (inode) > 1)
-    goto done;
 
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (ofs < inode_free_slot (dir->inode))
+    inode_set_free_slot (dir->inode, ofs);
 
-  /* Remove inode. */
+  /* Remove inode, the name refers to no file any more. */
+  dcache_insert (inode_get_inumber (dir->inode), name, BLOCK_ERROR);
+  if (inode_is_dir (inode))
+    dcache_purge_dir (inode_get_inumber (inode));
   inode_remove (inode);
   success = true;
 
  done:
   inode_close (inode);
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -255,32 +435,40 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  inode_lock (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          success = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock (dir->inode);
+  return success;
 }
 
 bool
 dir_listdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success = false;
 
+  inode_lock (dir->inode);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
     dir->pos += sizeof e;
     if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, "..")) {
       strlcpy (name, e.name, NAME_MAX + 1);
-      return true;
+      success = true;
+      break;
     } 
   }
-  return false;
+  inode_unlock (dir->inode);
+  return success;
 }
 
 bool dir_is_empty (struct inode *inode)
@@ -292,6 +480,7 @@ bool dir_is_empty (struct inode *inode)
   if (inode == NULL || !inode_is_dir (inode))
     return empty;
 
+  inode_lock (inode);
   for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) {
     if (e.in_use && strcmp (e.name, ".") && strcmp (e.name, "..")) {
@@ -299,6 +488,7 @@ bool dir_is_empty (struct inode *inode)
       break;
     }
   }
+  inode_unlock (inode);
   return empty;
 }
 
@@ -309,6 +499,7 @@ bool dir_entry_name (struct dir *dir, struct inode *inode, char *name)
   block_sector_t sector =  inode_get_inumber (inode);
   bool success = false;
 
+  inode_lock (dir->inode);
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) {
     if (e.in_use && e.inode_sector == sector &&
@@ -318,5 +509,96 @@ bool dir_entry_name (struct dir *dir, struct inode *inode, char *name)
       break;
     }
   }
+  inode_unlock (dir->inode);
   return success;
 }
+
+/* Rebuilds DIR as an indexed directory with enough buckets for its
+   entries to take up at most half of the slots, storing its new header
+   in *IDX.  The entries are read into memory, every slot of DIR is
+   cleared and the entries are added back.  Returns true if
+   successful. */
+static bool
+index_build (struct dir *dir, struct dir_index *idx)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+  struct dir_entry e, *entries;
+  size_t cnt = 0, i;
+  off_t ofs, length, end, chunk;
+  off_t free_ofs;
+  bool success = true;
+
+  /* Gather the entries in use, skipping the header if any. */
+  length = inode_length (dir->inode);
+  entries = malloc (length);
+  if (entries == NULL)
+    return false;
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    if (e.in_use)
+      entries[cnt++] = e;
+
+  idx->bucket_cnt = DIR_INDEX_MIN / DIR_BUCKET_SLOTS;
+  while ((cnt + 1) * 2 > idx->bucket_cnt * DIR_BUCKET_SLOTS)
+    idx->bucket_cnt *= 2;
+  memcpy (idx->magic, DIR_INDEX_MAGIC, sizeof idx->magic);
+  idx->used_cnt = cnt;
+  memset (idx->unused, 0, sizeof idx->unused);
+  idx->in_use = false;
+
+  /* Grow the directory to hold the new slots first, so that it is left
+     as it was if the disk is full, then clear the old entries and add
+     them again. */
+  end = index_slot_ofs (idx->bucket_cnt * DIR_BUCKET_SLOTS);
+  if (end < length)
+    end = length;
+  for (ofs = length; success && ofs < end; ofs += chunk)
+    {
+      chunk = end - ofs < BLOCK_SECTOR_SIZE ? end - ofs : BLOCK_SECTOR_SIZE;
+      success = inode_write_at (dir->inode, zeros, chunk, ofs) == chunk;
+    }
+  for (ofs = 0; success && ofs < length; ofs += chunk)
+    {
+      chunk = (length - ofs < BLOCK_SECTOR_SIZE
+               ? length - ofs : BLOCK_SECTOR_SIZE);
+      success = inode_write_at (dir->inode, zeros, chunk, ofs) == chunk;
+    }
+  success = success && (inode_write_at (dir->inode, idx, sizeof *idx, 0)
+                        == sizeof *idx);
+  for (i = 0; success && i < cnt; i++)
+    {
+      index_lookup (dir, idx, entries[i].name, NULL, NULL, &free_ofs, NULL);
+      success = (free_ofs != -1
+                 && inode_write_at (dir->inode, &entries[i],
+                                    sizeof entries[i], free_ofs)
+                    == sizeof entries[i]);
+    }
+  free (entries);
+  return success;
+}
+
+/* Adds entry E to DIR, which is indexed by IDX, or not indexed yet if
+   IDX is all zeros.  The index is rebuilt, with more buckets if needed,
+   when more than three quarters of its slots have been used.  Returns
+   true if successful. */
+static bool
+index_add (struct dir *dir, struct dir_index *idx, const struct dir_entry *e)
+{
+  off_t ofs;
+  bool is_new;
+
+  if ((idx->used_cnt + 1) * 4 > idx->bucket_cnt * DIR_BUCKET_SLOTS * 3
+      && !index_build (dir, idx))
+    return false;
+
+  index_lookup (dir, idx, e->name, NULL, NULL, &ofs, &is_new);
+  if (ofs == -1)
+    return false;
+  if (is_new)
+    {
+      idx->used_cnt++;
+      if (inode_write_at (dir->inode, idx, sizeof *idx, 0) != sizeof *idx)
+        return false;
+    }
+  return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+}
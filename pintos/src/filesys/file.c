@@ -1,9 +1,12 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <user/syscall.h>
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "threads/malloc.h"
 
+static void file_readahead (struct file *, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -17,6 +20,9 @@ file_open (struct inode *inode)
       file->pos = 0;
       file->deny_write = false;
       file->dir = NULL;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       if (inode_is_dir (inode))
 	file->dir = dir_open (inode);
       return file;
@@ -65,11 +71,54 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
+  file_readahead (file, size);
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Detects sequential reads of FILE and queues the sectors following a
+   read of SIZE bytes at the current position to be read ahead.
+   The window doubles each time the read finds the sectors read ahead
+   in the cache, and halves when they were evicted before being used.
+   Sectors cached for another reason say nothing about the window. */
+static void
+file_readahead (struct file *file, off_t size)
+{
+  off_t start, end;
+  bool prefetched;
+
+  if (file->pos != file->ra_next || file->dir != NULL)
+    {
+      /* Random access, stop reading ahead. */
+      file->ra_window = 0;
+      file->ra_end = 0;
+      file->ra_next = file->pos + size;
+      return;
+    }
+
+  if (file->ra_window == 0)
+    file->ra_window = RA_MIN_WINDOW;
+  else if (file->pos < file->ra_end)
+    {
+      if (!inode_is_cached (file->inode, file->pos, &prefetched))
+        file->ra_window = file->ra_window / 2 > RA_MIN_WINDOW
+                          ? file->ra_window / 2 : RA_MIN_WINDOW;
+      else if (prefetched)
+        file->ra_window = file->ra_window * 2 < RA_MAX_WINDOW
+                          ? file->ra_window * 2 : RA_MAX_WINDOW;
+    }
+
+  file->ra_next = file->pos + size;
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  end = file->ra_next + file->ra_window * BLOCK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_readahead (file->inode, start, end);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -81,6 +130,25 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads from FILE into the CNT buffers of IOV in turn, starting at
+   the file's current position, as one read.
+   Returns the number of bytes actually read,
+   which may be less than asked if end of file is reached.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, int cnt)
+{
+  off_t size = 0;
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    size += iov[i].iov_len;
+  file_readahead (file, size);
+  off_t bytes_read = inode_readv_at (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
@@ -110,6 +178,33 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes the CNT buffers of IOV in turn into FILE, starting at the
+   file's current position, as one write.
+   Returns the number of bytes actually written.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, int cnt)
+{
+  off_t bytes_written = inode_writev_at (file->inode, iov, cnt, file->pos);
+  file->pos += bytes_written;
+  return bytes_written;
+}
+
+/* Copies SIZE bytes of SRC, starting at its current position, into DST
+   at its current position, without leaving the kernel.
+   Returns the number of bytes actually copied,
+   which may be less than SIZE if the end of SRC is reached.
+   Advances both positions by the number of bytes copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  off_t bytes_copied = inode_copy_at (dst->inode, dst->pos,
+                                      src->inode, src->pos, size);
+  dst->pos += bytes_copied;
+  src->pos += bytes_copied;
+  return bytes_copied;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -4,7 +4,12 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 
+/* Read-ahead window of a sequentially read file, in sectors. */
+#define RA_MIN_WINDOW 4
+#define RA_MAX_WINDOW 16
+
 struct inode;
+struct iovec;
 /* An open file. */
 struct file 
   {
@@ -12,6 +17,9 @@ struct file
     struct dir *dir;            /* open directory for inode is a directory */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Offset a sequential read starts at. */
+    off_t ra_end;               /* End of the data already read ahead. */
+    int ra_window;              /* Sectors to read ahead, 0 if random. */
   };
 
 /* Opening and closing files. */
@@ -25,6 +33,9 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_readv (struct file *, const struct iovec *, int cnt);
+off_t file_writev (struct file *, const struct iovec *, int cnt);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
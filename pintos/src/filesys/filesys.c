@@ -7,6 +7,8 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
@@ -25,11 +27,13 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();    /** initial an empty inode list */  
+  dcache_init ();   /** forget all names */
   free_map_init (); /** create block free map in memory*/
 
   if (format) 
     do_format ();   /** writ block bitmap to a file and create root dir */
 
+  journal_open ();  /** replay committed metadata before reading any */
   free_map_open (); /** restore block bitmap from free_map file */
 }
 
@@ -39,6 +43,7 @@ void
 filesys_done (void) 
 {
   //printf ("flush cache.\n");
+  journal_close ();
   cache_flush_cache ();
   free_map_close ();
 }
@@ -55,21 +60,25 @@ filesys_create (const char *name, off_t initial_size)
   struct inode *inode;
   bool success = false;
 
+  journal_begin ();
   inode = inode_open_path (name, file_name);
   if (inode == NULL && *file_name == '\0') {
     free (file_name);
+    journal_end ();
     return success;
   }
 
   struct dir *dir = dir_open (inode);
   success = (dir != NULL
-	     && free_map_allocate (1, &inode_sector)
+	     && free_map_allocate_near (1, inode_get_inumber (inode),
+					&inode_sector)
 	     && inode_create (inode_sector, initial_size, false)
 	     && dir_add (dir, file_name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
   free (file_name);
+  journal_end ();
 
   return success;
 }
@@ -86,13 +95,17 @@ filesys_mkdir (const char *name)
   struct inode *inode;
   bool success = false;
 
+  journal_begin ();
   inode = inode_open_path (name, dir_name);
-  if (inode == NULL && *dir_name == '\0')
+  if (inode == NULL && *dir_name == '\0') {
+    journal_end ();
     return success;
+  }
 
   struct dir *dir = dir_open (inode);
   success = (dir != NULL
-	     && free_map_allocate (1, &inode_sector)
+	     && free_map_allocate_near (1, inode_get_inumber (inode),
+					&inode_sector)
 	     && dir_create (inode_sector, 2)
 	     && dir_add (dir, dir_name, inode_sector));
   if (!success && inode_sector != 0) 
@@ -106,6 +119,7 @@ filesys_mkdir (const char *name)
     dir_close (subdir);
   }
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -165,7 +179,10 @@ filesys_remove (const char *name)
 
   struct dir *dir;
   char *file_name = malloc (strlen (name) + 1);
-  struct inode *inode_path = inode_open_path (name, file_name);
+  struct inode *inode_path;
+
+  journal_begin ();
+  inode_path = inode_open_path (name, file_name);
 
   if (inode_path != NULL) {
     dir = dir_open (inode_path);
@@ -181,6 +198,7 @@ filesys_remove (const char *name)
     dir_close (dir);
   }
   free (file_name);
+  journal_end ();
   return success;
 }
 
@@ -191,6 +209,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();    /** write block free map to a file */
+  journal_create ();     /** empty journal */
   if (!dir_create (ROOT_DIR_SECTOR, 16)) /** create root dir with 16 entries */
     PANIC ("root directory creation failed");
 
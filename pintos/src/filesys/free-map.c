@@ -1,22 +1,201 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file whose bits have changed since they were
+   written to the file, one bit per sector of the file.  Only these are
+   written back, into the buffer cache, which writes them to disk. */
+static struct bitmap *free_map_dirty;
+static int batch_cnt;                /* nesting of free_map_batch_begin */
+
+/* The allocator lock, held while the free map, its groups and the free
+   map file are used.  It is taken by a thread writing a file, inside the
+   lock of that file's inode, and the free map file is written under it;
+   writing the free map file never allocates. */
+static struct lock lock_free_map;
+
+/* Number of sectors of the disk that a sector of the free map file
+   tracks. */
+#define SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* The disk is split into allocation groups of GROUP_SECTORS sectors,
+   each with its count of free sectors, so that the allocator goes
+   straight to a group with room near the goal it is given. */
+#define GROUP_SECTORS 1024
+static size_t *group_free;           /* free sectors in each group */
+static size_t group_cnt;             /* number of groups */
+
+static bool free_map_sync (void);
+static void group_count (void);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&lock_free_map);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                                SECTOR_BITS));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("allocation group creation failed");
+  group_count ();
+}
+
+/* Counts the free sectors of every allocation group. */
+static void
+group_count (void)
+{
+  size_t g, start, cnt;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      start = g * GROUP_SECTORS;
+      cnt = bitmap_size (free_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Adds DELTA to the free counts of the groups of the CNT sectors
+   starting at SECTOR. */
+static void
+group_adjust (block_sector_t sector, size_t cnt, int delta)
+{
+  size_t end = sector + cnt, n;
+
+  while (sector < end)
+    {
+      n = GROUP_SECTORS - sector % GROUP_SECTORS;
+      if (n > end - sector)
+        n = end - sector;
+      group_free[sector / GROUP_SECTORS] += delta * (int) n;
+      sector += n;
+    }
+}
+
+/* Returns the first of CNT free consecutive sectors between START and
+   END, or BITMAP_ERROR if there are none. */
+static size_t
+scan_range (size_t start, size_t end, size_t cnt)
+{
+  size_t i;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  for (i = start; i + cnt <= end; i++)
+    if (!bitmap_contains (free_map, i, cnt, true))
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Returns the first of CNT free consecutive sectors, preferring those at
+   or after GOAL in its group, then the rest of its group, then the
+   following groups that have CNT free sectors, or BITMAP_ERROR if there
+   are none anywhere. */
+static size_t
+free_map_scan (size_t cnt, block_sector_t goal)
+{
+  size_t g, i, start, sector;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  g = goal / GROUP_SECTORS;
+  if (cnt <= GROUP_SECTORS)
+    for (i = 0; i < group_cnt; i++, g = (g + 1) % group_cnt)
+      {
+        if (group_free[g] < cnt)
+          continue;
+        start = g * GROUP_SECTORS;
+        sector = BITMAP_ERROR;
+        if (i == 0)
+          sector = scan_range (goal, start + GROUP_SECTORS, cnt);
+        if (sector == BITMAP_ERROR)
+          sector = scan_range (start, start + GROUP_SECTORS, cnt);
+        if (sector != BITMAP_ERROR)
+          return sector;
+      }
+  /* Runs longer than a group, or free sectors split between groups. */
+  return bitmap_scan (free_map, 0, cnt, false);
+}
+
+/* Marks the sectors of the free map file holding the bits of the CNT
+   sectors starting at SECTOR as changed. */
+static void
+free_map_touch (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / SECTOR_BITS;
+  size_t last = (sector + cnt - 1) / SECTOR_BITS;
+
+  if (cnt > 0)
+    bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Writes the changed sectors of the free map to the free map file,
+   unless inside a batch.  Returns false if the file could not be
+   written. */
+static bool
+free_map_sync (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i, start;
+  bool success = true;
+
+  if (free_map_file == NULL || batch_cnt > 0)
+    return true;
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    if (bitmap_test (free_map_dirty, i))
+      {
+        /* Clear first, a write may allocate and mark it again. */
+        bitmap_reset (free_map_dirty, i);
+        start = i * SECTOR_BITS;
+        if (!bitmap_write_range (free_map, free_map_file, start,
+                                 bit_cnt - start < SECTOR_BITS
+                                 ? bit_cnt - start : SECTOR_BITS))
+          success = false;
+      }
+  return success;
+}
+
+/* Starts a batch of changes to the free map, such as releasing all the
+   sectors of a file.  The free map file is written once, when the
+   outermost batch ends with free_map_batch_end. */
+void
+free_map_batch_begin (void)
+{
+  lock_acquire (&lock_free_map);
+  batch_cnt++;
+  lock_release (&lock_free_map);
+}
+
+/* Ends a batch of changes started by free_map_batch_begin. */
+void
+free_map_batch_end (void)
+{
+  lock_acquire (&lock_free_map);
+  ASSERT (batch_cnt > 0);
+  batch_cnt--;
+  free_map_sync ();
+  lock_release (&lock_free_map);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +206,51 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Same as free_map_allocate, but the sectors are allocated as close
+   after GOAL as possible, such as after the last sector of a file. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t goal,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&lock_free_map);
+  sector = free_map_scan (cnt, goal);
+  if (sector != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      group_adjust (sector, cnt, -1);
+      free_map_touch (sector, cnt);
+    }
+  if (sector != BITMAP_ERROR && !free_map_sync ())
     {
       bitmap_set_multiple (free_map, sector, cnt, false); 
+      group_adjust (sector, cnt, 1);
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
+  lock_release (&lock_free_map);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use, once the
+   journal does not hold them anymore. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
+  if (journal_defer_release (sector, cnt))
+    return;
+  lock_acquire (&lock_free_map);
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  group_adjust (sector, cnt, 1);
+  free_map_touch (sector, cnt);
+  free_map_sync ();
+  lock_release (&lock_free_map);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,6 +262,8 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  group_count ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -82,4 +288,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
@@ -1,28 +1,76 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <stdio.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
 
 /* Identifies an inode. */
 /** ASCII value of 'INODE' */
 #define INODE_MAGIC 0x494e4f44
+/* Identifies an inode in the extent format, ASCII 'INOE'. */
+#define INODE_EXTENT_MAGIC 0x494e4f45
 
-/* On-disk inode.
+#define EXTENT_INLINE_CNT 41  /* extents in an inode */
+#define EXTENT_LEAF_CNT 42    /* extents in a leaf block */
+
+#define INODE_DIRTY_CNT 48    /* data sectors an inode remembers writing */
+
+/* A run of LENGTH sectors on disk starting at START, holding the sectors
+   of the file starting at sector LOGICAL. */
+struct inode_extent
+  {
+    block_sector_t logical;   /* First sector in the file. */
+    block_sector_t start;     /* First sector on disk. */
+    block_sector_t length;    /* Number of sectors. */
+  };
+
+/* Extent tree of an inode in the extent format.  The extents map the
+   sectors of the file in order; the sectors between them are holes.  At
+   depth 0 the extents are in the inode itself; at depth 1 each extent in
+   the inode maps a leaf block instead, START being the sector of the leaf
+   and LOGICAL and LENGTH the sectors of the file from the first to the
+   last the leaf maps. */
+struct inode_extents
+  {
+    unsigned depth;           /* 0 or 1. */
+    unsigned cnt;             /* Number of extents used. */
+    struct inode_extent extents[EXTENT_INLINE_CNT];
+  };
+
+/* Leaf block of an extent tree.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct inode_extent_leaf
+  {
+    unsigned cnt;             /* Number of extents used. */
+    unsigned unused;
+    struct inode_extent extents[EXTENT_LEAF_CNT];
+  };
+
+/* On-disk inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.  An inode with
+   INODE_MAGIC maps its sectors through direct, indirect and double
+   indirect sector tables, one with INODE_EXTENT_MAGIC through extents. */
 struct inode_disk
   {
     off_t length;             /* File size in bytes. */
     unsigned magic;           /* Magic number. */
     unsigned is_dir;          /* is the inode a directory 0:false, others:true*/
-    block_sector_t block[BLOCKS_NUM];
+    union
+      {
+        block_sector_t block[BLOCKS_NUM];
+        struct inode_extents ext;
+      };
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -43,90 +91,554 @@ struct inode_indirect
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* being read by its first opener */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct lock lock_inode;             /* lock hold when modify */
+    struct shared_lock rw;              /* shared by readers and writers,
+					   held alone to grow the file */
+    struct lock lock_inode;             /* directory: lock of the entries */
     struct inode_disk data;             /* Inode content. */
+    /* Block map: copies of the sector tables, read on first use and kept
+       in step by byte_to_sector and inode_expand_sector. */
+    struct lock lock_map;               /* lock when accessing the map */
+    struct inode_indirect *map_indirect; /* the indirect segment */
+    struct inode_indirect *map_dbl;     /* the double indirect segment */
+    struct inode_indirect **map_dbl_tables; /* the segments it points to */
+    struct inode_extent_leaf **map_leaves; /* the extent leaf blocks */
+    struct inode_extent map_hint;       /* the extent looked up last */
+    block_sector_t goal;                /* where to allocate sectors next */
+    off_t free_slot;                    /* directory: no free entry before */
+    /* Data sectors written since they were last flushed, so that fsync
+       need not look through the file or the cache. */
+    struct lock lock_dirty;             /* lock of the dirty index */
+    struct lock lock_flush;             /* held while it is flushed */
+    block_sector_t dirty[INODE_DIRTY_CNT]; /* the sectors written */
+    int dirty_cnt;                      /* ...how many, -1 if too many */
+    bool meta_dirty;                    /* length or map changed since */
+    unsigned meta_gen;                  /* ...counts those changes */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Create new inodes in the extent format, cleared by -inode-format. */
+bool inode_extents = true;
+
+static size_t inode_walk (struct inode *, bool release);
+
+/* Returns true if INODE is in the extent format. */
+static bool
+inode_is_extent (const struct inode *inode)
+{
+  return inode->data.magic == INODE_EXTENT_MAGIC;
+}
+
+/* Returns the kind of data INODE holds, for the buffer cache statistics. */
+static enum cache_class
+inode_class (const struct inode *inode)
+{
+  return (inode_is_dir (inode) || inode->sector == FREE_MAP_SECTOR
+	  ? CACHE_META : CACHE_DATA);
+}
+
+/* Returns slot IDX of the sector table starting at byte TABLE_OFS of
+   sector TABLE.  The table is read in place in the buffer cache. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+table_get (block_sector_t table, size_t table_ofs, block_sector_t idx)
 {
-  ASSERT (inode != NULL);
+  struct cache_entry *buffer;
+  const block_sector_t *slots;
+  block_sector_t sector;
 
-  struct inode_disk *inode_block;
-  struct inode_indirect *indirect, *dbl_indirect;
-  block_sector_t indirect_idx, dbl_indirect_idx;
+  slots = cache_read_get (table, CACHE_META, &buffer) + table_ofs;
+  sector = slots[idx];
+  cache_read_put (buffer);
+  return sector;
+}
+
+/* Same as table_get, but a slot of 0, which is reserved by
+   inode_expand_sector, gets a newly allocated sector of zeros, as close
+   after *GOAL as possible; *GOAL is advanced past it. */
+static block_sector_t
+table_get_alloc (block_sector_t table, size_t table_ofs, block_sector_t idx,
+		 block_sector_t *goal)
+{
+  struct cache_entry *buffer;
+  block_sector_t *slots;
   block_sector_t sector;
 
-  block_sector_t pos_sector = pos / BLOCK_SECTOR_SIZE;
-  inode_block = calloc (1, sizeof (*inode_block));
-  cache_block_read (fs_device, inode->sector, inode_block);
-  
-  if (pos_sector < INDIRECT_BEGIN) {
-    sector = inode_block->block[pos_sector];
-    if (sector == 0) {
-      inode_block->block[pos_sector] = inode_alloc_zeros (&sector);
-      cache_block_write (fs_device, inode->sector, inode_block);
+  sector = table_get (table, table_ofs, idx);
+  if (sector != 0)
+    return sector;
+
+  sector = 0;
+  inode_alloc_zeros (*goal, &sector);
+  if (sector == 0 || sector == BLOCK_ERROR)
+    return BLOCK_ERROR;
+  *goal = sector + 1;
+  slots = cache_write_get (table, CACHE_META, &buffer) + table_ofs;
+  if (slots[idx] == 0) {
+    slots[idx] = sector;
+  } else { // allocated by another thread in the meantime
+    free_map_release (sector, 1);
+    sector = slots[idx];
+  }
+  cache_write_put (buffer);
+  return sector;
+}
+
+/* Returns the copy of sector table TABLE in *COPY, reading it on first
+   use, or a null pointer if COPY is null or memory runs out. */
+static struct inode_indirect *
+map_table (struct inode_indirect **copy, block_sector_t table)
+{
+  if (copy == NULL)
+    return NULL;
+  if (*copy == NULL) {
+    *copy = malloc (sizeof **copy);
+    if (*copy != NULL)
+      cache_block_read (fs_device, table, *copy, CACHE_META);
+  }
+  return *copy;
+}
+
+/* Returns slot IDX of sector table TABLE through its copy in *COPY. */
+static block_sector_t
+map_get (struct inode_indirect **copy, block_sector_t table,
+	 block_sector_t idx)
+{
+  struct inode_indirect *slots = map_table (copy, table);
+
+  return slots != NULL ? slots->block[idx] : table_get (table, 0, idx);
+}
+
+/* Same as map_get with table_get_alloc, for the table starting at byte
+   TABLE_OFS of sector TABLE whose copy is SLOTS.  If GOAL is null a slot
+   of 0 is a hole, returned as BLOCK_ERROR. */
+static block_sector_t
+map_get_alloc (block_sector_t *slots, block_sector_t table, size_t table_ofs,
+	       block_sector_t idx, block_sector_t *goal)
+{
+  block_sector_t sector;
+
+  if (slots != NULL && slots[idx] != 0)
+    return slots[idx];
+  if (goal == NULL) {
+    sector = slots != NULL ? 0 : table_get (table, table_ofs, idx);
+    return sector != 0 ? sector : BLOCK_ERROR;
+  }
+  sector = table_get_alloc (table, table_ofs, idx, goal);
+  if (slots != NULL && sector != BLOCK_ERROR)
+    slots[idx] = sector;
+  return sector;
+}
+
+/* Keep COPY, a copy of a sector table in a block map if not null, in step
+   with TABLE just written. */
+static void
+map_refresh (struct inode_indirect *copy, const struct inode_indirect *table)
+{
+  if (copy != NULL)
+    memcpy (copy, table, sizeof *copy);
+}
+
+/* Frees the block map of INODE. */
+static void
+map_free (struct inode *inode)
+{
+  size_t i;
+
+  free (inode->map_indirect);
+  free (inode->map_dbl);
+  if (inode->map_dbl_tables != NULL)
+    for (i = 0; i < BLOCK_SLOTS; i++)
+      free (inode->map_dbl_tables[i]);
+  free (inode->map_dbl_tables);
+  if (inode->map_leaves != NULL)
+    for (i = 0; i < EXTENT_INLINE_CNT; i++)
+      free (inode->map_leaves[i]);
+  free (inode->map_leaves);
+}
+
+/* Returns the number of sectors the extent tree EXT maps. */
+static block_sector_t
+extent_end (const struct inode_extents *ext)
+{
+  const struct inode_extent *last;
+
+  if (ext->cnt == 0)
+    return 0;
+  last = &ext->extents[ext->cnt - 1];
+  return last->logical + last->length;
+}
+
+/* Returns the extent among the CNT EXTENTS that maps sector POS of the
+   file, or a null pointer if there is none. */
+static const struct inode_extent *
+extent_find (const struct inode_extent *extents, size_t cnt,
+	     block_sector_t pos)
+{
+  size_t lo = 0, hi = cnt, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (pos < extents[mid].logical)
+      hi = mid;
+    else if (pos - extents[mid].logical >= extents[mid].length)
+      lo = mid + 1;
+    else
+      return &extents[mid];
+  }
+  return NULL;
+}
+
+/* Returns the copy of the leaf block IDX of the extent tree of INODE,
+   reading it on first use, or a null pointer if memory runs out. */
+static struct inode_extent_leaf *
+extent_leaf (struct inode *inode, size_t idx)
+{
+  struct inode_extent_leaf *leaf;
+
+  if (inode->map_leaves == NULL)
+    inode->map_leaves = calloc (EXTENT_INLINE_CNT,
+				sizeof *inode->map_leaves);
+  if (inode->map_leaves == NULL)
+    return NULL;
+  if (inode->map_leaves[idx] == NULL) {
+    leaf = malloc (sizeof *leaf);
+    if (leaf == NULL)
+      return NULL;
+    cache_block_read (fs_device, inode->data.ext.extents[idx].start, leaf,
+		      CACHE_META);
+    inode->map_leaves[idx] = leaf;
+  }
+  return inode->map_leaves[idx];
+}
+
+/* Allocates a leaf block of zeros for the extent tree of INODE on disk
+   and in memory, storing its sector in *SECTOR.  Returns the leaf, or a
+   null pointer if out of memory or disk space. */
+static struct inode_extent_leaf *
+extent_alloc_leaf (struct inode *inode, block_sector_t *sector)
+{
+  struct inode_extent_leaf *leaf;
+
+  if (inode->map_leaves == NULL)
+    inode->map_leaves = calloc (EXTENT_INLINE_CNT,
+				sizeof *inode->map_leaves);
+  if (inode->map_leaves == NULL)
+    return NULL;
+  leaf = calloc (1, sizeof *leaf);
+  if (leaf == NULL)
+    return NULL;
+  if (!free_map_allocate_near (1, inode->goal, sector)) {
+    free (leaf);
+    return NULL;
+  }
+  return leaf;
+}
+
+/* Returns the number of the CNT EXTENTS that start before sector LOGICAL
+   of the file. */
+static size_t
+extent_count_before (const struct inode_extent *extents, size_t cnt,
+		     block_sector_t logical)
+{
+  size_t lo = 0, hi = cnt, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (extents[mid].logical < logical)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Sets extent E of an extent tree of depth 1 to span the sectors of the
+   file mapped by LEAF, its leaf block, unless LEAF is empty. */
+static void
+extent_span (struct inode_extent *e, const struct inode_extent_leaf *leaf)
+{
+  const struct inode_extent *last;
+
+  if (leaf->cnt == 0)
+    return;
+  last = &leaf->extents[leaf->cnt - 1];
+  e->logical = leaf->extents[0].logical;
+  e->length = last->logical + last->length - e->logical;
+}
+
+/* Adds a new leaf block to the extent tree of INODE, which must have depth
+   1, after leaf LI, moving the extents of leaf LI from index I on into it.
+   With I at the end of leaf LI the new leaf starts empty, mapping from
+   sector LOGICAL.  Returns false if the tree is full or out of memory or
+   disk space. */
+static bool
+extent_split (struct inode *inode, size_t li, size_t i,
+	      block_sector_t logical)
+{
+  struct inode_extents *ext = &inode->data.ext;
+  struct inode_extent_leaf *leaf = inode->map_leaves[li], *next;
+  struct inode_extent *e;
+  block_sector_t sector;
+  size_t after = ext->cnt - li - 1;
+
+  ASSERT (ext->depth == 1 && leaf != NULL && i <= leaf->cnt);
+
+  if (ext->cnt == EXTENT_INLINE_CNT)
+    return false;
+  next = extent_alloc_leaf (inode, &sector);
+  if (next == NULL)
+    return false;
+  next->cnt = leaf->cnt - i;
+  memcpy (next->extents, &leaf->extents[i], next->cnt * sizeof *next->extents);
+  leaf->cnt = i;
+
+  memmove (&ext->extents[li + 2], &ext->extents[li + 1],
+	   after * sizeof *ext->extents);
+  memmove (&inode->map_leaves[li + 2], &inode->map_leaves[li + 1],
+	   after * sizeof *inode->map_leaves);
+  ext->cnt++;
+  e = &ext->extents[li + 1];
+  e->logical = logical;
+  e->start = sector;
+  e->length = 0;
+  inode->map_leaves[li + 1] = next;
+  extent_span (&ext->extents[li], leaf);
+  extent_span (e, next);
+
+  cache_block_write (fs_device, ext->extents[li].start, leaf, CACHE_META);
+  cache_block_write (fs_device, sector, next, CACHE_META);
+  cache_block_write (fs_device, inode->sector, &inode->data, CACHE_META);
+  return true;
+}
+
+/* Moves the extents of INODE, a full extent tree of depth 0, into a leaf
+   block, which becomes the only extent of the inode.  Returns false if out
+   of memory or disk space. */
+static bool
+extent_deepen (struct inode *inode)
+{
+  struct inode_extents *ext = &inode->data.ext;
+  struct inode_extent_leaf *leaf;
+  block_sector_t sector;
+
+  ASSERT (ext->depth == 0);
+
+  leaf = extent_alloc_leaf (inode, &sector);
+  if (leaf == NULL)
+    return false;
+  memcpy (leaf->extents, ext->extents, ext->cnt * sizeof *ext->extents);
+  leaf->cnt = ext->cnt;
+  ext->extents[0].start = sector;
+  extent_span (&ext->extents[0], leaf);
+  ext->cnt = 1;
+  ext->depth = 1;
+  inode->map_leaves[0] = leaf;
+  return true;
+}
+
+/* Maps the LENGTH sectors of INODE starting at LOGICAL, which must be a
+   hole, to the sectors starting at START on disk, extending the extent
+   before them if they follow it both in the file and on disk.  Returns
+   false if the tree is full or out of memory or disk space. */
+static bool
+extent_insert (struct inode *inode, block_sector_t logical,
+	       block_sector_t start, block_sector_t length)
+{
+  struct inode_extents *ext = &inode->data.ext;
+  struct inode_extent_leaf *leaf = NULL;
+  struct inode_extent *extents, *prev;
+  unsigned *cnt, max_cnt;
+  size_t li = 0, i;
+
+  if (ext->depth == 0) {
+    extents = ext->extents;
+    cnt = &ext->cnt;
+    max_cnt = EXTENT_INLINE_CNT;
+  } else {
+    // the leaf of the last extent before LOGICAL, or the first leaf
+    li = extent_count_before (ext->extents, ext->cnt, logical + 1);
+    li = li > 0 ? li - 1 : 0;
+    leaf = extent_leaf (inode, li);
+    if (leaf == NULL)
+      return false;
+    extents = leaf->extents;
+    cnt = &leaf->cnt;
+    max_cnt = EXTENT_LEAF_CNT;
+  }
+
+  i = extent_count_before (extents, *cnt, logical);
+  prev = i > 0 ? &extents[i - 1] : NULL;
+  if (prev != NULL && prev->logical + prev->length == logical
+      && prev->start + prev->length == start)
+    prev->length += length;
+  else if (*cnt < max_cnt) {
+    memmove (&extents[i + 1], &extents[i], (*cnt - i) * sizeof *extents);
+    extents[i].logical = logical;
+    extents[i].start = start;
+    extents[i].length = length;
+    (*cnt)++;
+  } else if (ext->depth == 0)
+    return extent_deepen (inode) && extent_insert (inode, logical, start,
+						   length);
+  else if (li == ext->cnt - 1 && i == *cnt)
+    // appending to the file, start a new leaf
+    return (extent_split (inode, li, i, logical)
+	    && extent_insert (inode, logical, start, length));
+  else
+    return (extent_split (inode, li, EXTENT_LEAF_CNT / 2,
+			  extents[EXTENT_LEAF_CNT / 2].logical)
+	    && extent_insert (inode, logical, start, length));
+
+  if (leaf != NULL) {
+    extent_span (&ext->extents[li], leaf);
+    cache_block_write (fs_device, ext->extents[li].start, leaf, CACHE_META);
+  }
+  cache_block_write (fs_device, inode->sector, &inode->data, CACHE_META);
+  return true;
+}
+
+/* Allocates sectors to the hole of INODE, which is in the extent format,
+   from sector POS up to END.  Each request to the free map is for all the
+   sectors still missing, halved until it can be met, so the hole is filled
+   by runs as long as the free space allows.  The new sectors are zeroed if
+   ZERO, otherwise the caller must write them before they are read.
+   Returns false if out of memory or disk space. */
+static bool
+extent_grow (struct inode *inode, block_sector_t pos, block_sector_t end,
+	     bool zero)
+{
+  block_sector_t start, cnt, i;
+
+  while (pos < end) {
+    cnt = end - pos;
+    while (!free_map_allocate_near (cnt, inode->goal, &start))
+      if ((cnt /= 2) == 0)
+	return false;
+    if (!extent_insert (inode, pos, start, cnt)) {
+      free_map_release (start, cnt);
+      return false;
     }
+    inode->goal = start + cnt;
+    if (zero)
+      for (i = 0; i < cnt; i++)
+	cache_block_write_at (start + i, NULL, 0, BLOCK_SECTOR_SIZE, true,
+			      inode_class (inode));
+    pos += cnt;
+  }
+  return true;
+}
+
+/* Returns the sector on disk of sector POS of INODE, which is in the
+   extent format, or BLOCK_ERROR if the extent tree does not map it.
+   Sequential access finds the sector in the extent looked up last. */
+static block_sector_t
+extent_to_sector (struct inode *inode, block_sector_t pos)
+{
+  const struct inode_extents *ext = &inode->data.ext;
+  const struct inode_extent *e = &inode->map_hint;
+  const struct inode_extent_leaf *leaf;
+
+  if (pos - e->logical >= e->length) {
+    e = extent_find (ext->extents, ext->cnt, pos);
+    if (e != NULL && ext->depth > 0) {
+      leaf = extent_leaf (inode, e - ext->extents);
+      e = leaf != NULL ? extent_find (leaf->extents, leaf->cnt, pos) : NULL;
+    }
+    if (e == NULL)
+      return BLOCK_ERROR;
+    inode->map_hint = *e;
+  }
+  return e->start + (pos - e->logical);
+}
+
+/* Returns the sector on disk of sector POS_SECTOR of INODE, or BLOCK_ERROR
+   if it is a hole or past the end of the sector tables.  If ALLOC, a slot
+   reserved by expand_sector gets a sector of zeros.  The sector tables
+   are looked up in the block map of INODE, so the buffer cache is only
+   used when a reserved sector is allocated.  The block map must be
+   locked. */
+static block_sector_t
+map_sector (struct inode *inode, block_sector_t pos_sector, bool alloc)
+{
+  const size_t blocks_ofs = offsetof (struct inode_disk, block);
+  block_sector_t *goal = alloc ? &inode->goal : NULL;
+  struct inode_indirect **copy;
+  struct inode_indirect *slots;
+  block_sector_t indirect_idx, dbl_indirect_idx;
+  block_sector_t sector = BLOCK_ERROR;
+  block_sector_t table;
+
+  if (inode_is_extent (inode)) {
+    sector = extent_to_sector (inode, pos_sector);
+  } else if (pos_sector < INDIRECT_BEGIN) {
+    sector = map_get_alloc (inode->data.block, inode->sector, blocks_ofs,
+			    pos_sector, goal);
   } else if (pos_sector < DBL_INDIRECT_BEGIN) {
-    sector = inode_block->block[INDIRECT_BLK];
-    if (sector != BLOCK_ERROR) {
-      indirect = calloc (1, sizeof (*indirect));
-      cache_block_read (fs_device, sector, indirect);
-      sector = indirect->block[pos_sector - INDIRECT_BEGIN];
-      if (sector == 0) {
-	indirect->block[pos_sector-DIRECT_BLK_LEN] = inode_alloc_zeros(&sector);
-	cache_block_write (fs_device, inode_block->block[INDIRECT_BLK],
-			   indirect);
-      }
-      free (indirect);
+    table = inode->data.block[INDIRECT_BLK];
+    if (table != BLOCK_ERROR) {
+      slots = map_table (&inode->map_indirect, table);
+      sector = map_get_alloc (slots != NULL ? slots->block : NULL, table, 0,
+			      pos_sector - INDIRECT_BEGIN, goal);
     }
   } else if (pos_sector < MAX_FILE_SECTOR) {
     indirect_idx = (pos_sector - DBL_INDIRECT_BEGIN) / BLOCK_SLOTS;
     dbl_indirect_idx = (pos_sector - DBL_INDIRECT_BEGIN) % BLOCK_SLOTS;
-    sector = inode_block->block[DBL_INDIRECT_BLK];
-    if (sector != BLOCK_ERROR) {
-      indirect = calloc (1, sizeof (*indirect));
-      cache_block_read (fs_device, sector, indirect);
-      sector = indirect->block[indirect_idx];
-      if (sector != BLOCK_ERROR) { 
-	dbl_indirect = calloc (1, sizeof (*dbl_indirect));
-	cache_block_read (fs_device, sector, dbl_indirect);
-	sector = dbl_indirect->block[dbl_indirect_idx];
-	if (sector == 0) {
-	  dbl_indirect->block[dbl_indirect_idx] = inode_alloc_zeros (&sector);
-	  cache_block_write (fs_device, indirect->block[indirect_idx],
-			     dbl_indirect);
-	}
-	free (dbl_indirect);
-      }
-      free (indirect);
+    if (inode->map_dbl_tables == NULL)
+      inode->map_dbl_tables = calloc (BLOCK_SLOTS,
+				      sizeof *inode->map_dbl_tables);
+    copy = (inode->map_dbl_tables != NULL
+	    ? &inode->map_dbl_tables[indirect_idx] : NULL);
+    table = inode->data.block[DBL_INDIRECT_BLK];
+    if (table != BLOCK_ERROR)
+      table = map_get (&inode->map_dbl, table, indirect_idx);
+    if (table != BLOCK_ERROR) {
+      slots = map_table (copy, table);
+      sector = map_get_alloc (slots != NULL ? slots->block : NULL, table, 0,
+			      dbl_indirect_idx, goal);
     }
   }
-  free (inode_block);
   return sector;
 }
-/*Allocate a free block initialed to zeros, -1 if no free block found */
-block_sector_t inode_alloc_zeros (block_sector_t *sector)
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS, which then reads as zero if it is before the end of file:
+   sectors are allocated to a file only when they are written. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos) 
 {
-  if (free_map_allocate (1, sector)) {
-    static char zeros[BLOCK_SECTOR_SIZE];
-    cache_block_write (fs_device, *sector, zeros);
+  block_sector_t sector;
+
+  ASSERT (inode != NULL);
+
+  lock_acquire (&inode->lock_map);
+  sector = map_sector (inode, pos / BLOCK_SECTOR_SIZE, false);
+  lock_release (&inode->lock_map);
+  return sector;
+}
+
+/*Allocate a free block initialed to zeros, as close after GOAL as
+  possible, -1 if no free block found */
+block_sector_t inode_alloc_zeros (block_sector_t goal, block_sector_t *sector)
+{
+  if (free_map_allocate_near (1, goal, sector)) {
+    cache_block_write_at (*sector, NULL, 0, BLOCK_SECTOR_SIZE, true,
+			  CACHE_DATA);
     return *sector;
   }
   return -1;
 }
 
 
-bool inode_expand_sector (struct inode *inode, block_sector_t pos_sector) 
+/* Reserves the sector POS_SECTOR of INODE, allocating the sector tables
+   on the way; the block map is locked by inode_expand_sector. */
+static bool
+expand_sector (struct inode *inode, block_sector_t pos_sector) 
 {
   ASSERT (inode != NULL);
 
@@ -141,28 +653,29 @@ bool inode_expand_sector (struct inode *inode, block_sector_t pos_sector)
     if (inode_block->block[pos_sector] == BLOCK_ERROR) {
       inode_block->block[pos_sector] = 0;
     }
-    cache_block_write (fs_device, inode->sector, inode_block);
+    cache_block_write (fs_device, inode->sector, inode_block, CACHE_META);
     success = true;
 
   } else if (pos_sector < DBL_INDIRECT_BEGIN) {
     if (inode_block->block[INDIRECT_BLK] != BLOCK_ERROR) {
       cache_block_read (fs_device, inode_block->block[INDIRECT_BLK],
-			&indirect);
+			&indirect, CACHE_META);
      } else {  // allocate a new indirect segment
-      if (free_map_allocate (1, &inode_block->block[INDIRECT_BLK])) {
+      if (free_map_allocate_near (1, inode->goal, &inode_block->block[INDIRECT_BLK])) {
 	for (i = 0; i < BLOCK_SLOTS; i++)
 	  indirect.block[i] = BLOCK_ERROR;
       } else {
 	return false;
       }
-      cache_block_write (fs_device, inode->sector, inode_block);
+      cache_block_write (fs_device, inode->sector, inode_block, CACHE_META);
     }
  
     if (indirect.block[pos_sector - DIRECT_BLK_LEN] == BLOCK_ERROR) {
 	indirect.block[pos_sector - DIRECT_BLK_LEN] = 0;
     }
     cache_block_write (fs_device, inode_block->block[INDIRECT_BLK],
-		       &indirect);
+		       &indirect, CACHE_META);
+    map_refresh (inode->map_indirect, &indirect);
     success = true;
 
   } else if (pos_sector < MAX_FILE_SECTOR) {
@@ -171,50 +684,97 @@ bool inode_expand_sector (struct inode *inode, block_sector_t pos_sector)
 
     if (inode_block->block[DBL_INDIRECT_BLK] != BLOCK_ERROR) {
       cache_block_read (fs_device, inode_block->block[DBL_INDIRECT_BLK],
-			&indirect);
+			&indirect, CACHE_META);
     } else { // allocate a new indirect segment
-      if (free_map_allocate (1, &inode_block->block[DBL_INDIRECT_BLK])) {
+      if (free_map_allocate_near (1, inode->goal, &inode_block->block[DBL_INDIRECT_BLK])) {
 	for (i = 0; i < BLOCK_SLOTS; i++)
 	  indirect.block[i] = BLOCK_ERROR;
       } else {
 	return false;
       }
-      cache_block_write (fs_device, inode->sector, inode_block);
+      cache_block_write (fs_device, inode->sector, inode_block, CACHE_META);
     }
 
     if (indirect.block[indirect_idx] != BLOCK_ERROR) { 
       cache_block_read (fs_device, indirect.block[indirect_idx],
-			&dbl_indirect);
+			&dbl_indirect, CACHE_META);
     } else { // allocate a new double indirect segment
-	if (free_map_allocate (1, &indirect.block[indirect_idx])) {
+	if (free_map_allocate_near (1, inode->goal, &indirect.block[indirect_idx])) {
 	  for (i = 0; i < BLOCK_SLOTS; i++)
 	    dbl_indirect.block[i] = BLOCK_ERROR;
 	} else {
 	  return false;
 	}
 	cache_block_write (fs_device, inode_block->block[DBL_INDIRECT_BLK],
-		       &indirect);
+		       &indirect, CACHE_META);
+	map_refresh (inode->map_dbl, &indirect);
     }
 
     if (dbl_indirect.block[dbl_indirect_idx] == BLOCK_ERROR) {
       dbl_indirect.block[dbl_indirect_idx] = 0;
     }
     cache_block_write (fs_device, indirect.block[indirect_idx],
-		       &dbl_indirect);
+		       &dbl_indirect, CACHE_META);
+    if (inode->map_dbl_tables != NULL)
+      map_refresh (inode->map_dbl_tables[indirect_idx], &dbl_indirect);
     success =  true;
   }
   return success;
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Allocates a sector of zeros to sector POS_SECTOR of INODE if it is a
+   hole, with the sector tables on the way.  Returns true if successful. */
+bool inode_expand_sector (struct inode *inode, block_sector_t pos_sector) 
+{
+  bool success;
+
+  lock_acquire (&inode->lock_map);
+  if (inode_is_extent (inode))
+    success = (extent_to_sector (inode, pos_sector) != BLOCK_ERROR
+	       || extent_grow (inode, pos_sector, pos_sector + 1, true));
+  else
+    success = (expand_sector (inode, pos_sector)
+	       && map_sector (inode, pos_sector, true) != BLOCK_ERROR);
+  lock_release (&inode->lock_map);
+  return success;
+}
+
+/* Reads of inodes in progress, and how many began while another one
+   was, which shows that readers are not serialized. */
+static int reads_active;
+static unsigned long long read_overlaps;
+
+/* Open inodes keyed by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+static struct lock lock_open_inodes;  /* lock when accessing open_inodes and
+					 the open_cnt of the inodes */
+static struct condition cond_loaded;  /* event an inode has been read */
+static unsigned long long open_lookups; /* lookups in open_inodes */
+static unsigned long long open_probes;  /* inodes compared in the table */
+
+static unsigned
+open_inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+open_inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		 void *aux UNUSED)
+{
+  open_probes++;
+  return (hash_entry (a, struct inode, elem)->sector
+	  < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, open_inode_hash, open_inode_less, NULL);
+  lock_init (&lock_open_inodes);
+  cond_init (&cond_loaded);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -235,26 +795,45 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct inode_extent_leaf) == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL) {
     size_t sectors = bytes_to_sectors (length);
     disk_inode->length = length;
-    disk_inode->magic = INODE_MAGIC;
+    disk_inode->magic = inode_extents ? INODE_EXTENT_MAGIC : INODE_MAGIC;
     disk_inode->is_dir = (is_dir? 1 : 0);
-    for (i = 0; i < BLOCKS_NUM; i++)       //initial all blocks to -1
-      disk_inode->block[i] = -1;
+    if (!inode_extents)
+      for (i = 0; i < BLOCKS_NUM; i++)     //initial all blocks to -1
+	disk_inode->block[i] = -1;
     
-    cache_block_write (fs_device, sector, disk_inode);
+    cache_block_write (fs_device, sector, disk_inode, CACHE_META);
     free (disk_inode);
     if (sectors > 0) {
+      /* The sectors are allocated right away, not left as a hole, so that
+         the free map file never allocates sectors while it is written. */
       inode = inode_open (sector);
-      for (i = 0; i < sectors; i++)
-	if (!inode_expand_sector (inode, i)) {
-	  return false;
-	}
+      if (inode == NULL)
+	return false;
+      if (inode_extents) {
+	// a single request for all the sectors, in as few runs as possible
+	lock_acquire (&inode->lock_map);
+	success = extent_grow (inode, 0, sectors, true);
+	lock_release (&inode->lock_map);
+      } else {
+	success = true;
+	for (i = 0; success && i < sectors; i++)
+	  success = inode_expand_sector (inode, i);
+      }
+      if (!success) {
+	// free the sectors allocated so far; SECTOR is freed by the caller
+	lock_acquire (&inode->lock_map);
+	inode_walk (inode, true);
+	lock_release (&inode->lock_map);
+      }
       //cache_block_write (fs_device, sector, &inode->data);
       inode_close (inode);
+      return success;
     }
     success = true;
   }
@@ -267,35 +846,70 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
-  struct inode *inode;
-
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  struct hash_elem *e;
+  struct inode *inode, key;
+
+  /* Check whether this inode is already open.  A new inode is entered
+     in the table as loading and read without the table locked; other
+     openers of it wait until it has been read, so it is read only
+     once. */
+  key.sector = sector;
+  lock_acquire (&lock_open_inodes);
+  open_lookups++;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL) 
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&cond_loaded, &lock_open_inodes);
+      lock_release (&lock_open_inodes);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&lock_open_inodes);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
+  inode->loading = true;
+  lock_release (&lock_open_inodes);
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  init_shared (&inode->rw);
   lock_init (&inode->lock_inode);
-
-  cache_block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock_map);
+  lock_init (&inode->lock_dirty);
+  lock_init (&inode->lock_flush);
+  inode->dirty_cnt = 0;
+  inode->meta_dirty = false;
+  inode->meta_gen = 0;
+  inode->map_indirect = NULL;
+  inode->map_dbl = NULL;
+  inode->map_dbl_tables = NULL;
+  inode->map_leaves = NULL;
+  inode->map_hint.length = 0;
+  inode->goal = inode->sector + 1;
+  inode->free_slot = 0;
+
+  cache_block_read (fs_device, inode->sector, &inode->data, CACHE_META);
+  // go on growing the file after its last extent
+  if (inode_is_extent (inode) && inode->data.ext.depth == 0
+      && inode->data.ext.cnt > 0)
+    inode->goal = (inode->data.ext.extents[inode->data.ext.cnt - 1].start
+		   + inode->data.ext.extents[inode->data.ext.cnt - 1].length);
+
+  lock_acquire (&lock_open_inodes);
+  inode->loading = false;
+  cond_broadcast (&cond_loaded, &lock_open_inodes);
+  lock_release (&lock_open_inodes);
   IDEBUG("inode open:%p(%d),sector=%d.\n",inode,inode->open_cnt,inode->sector);
   return inode;
 }
@@ -304,8 +918,11 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL)
+  if (inode != NULL) {
+    lock_acquire (&lock_open_inodes);
     inode->open_cnt++;
+    lock_release (&lock_open_inodes);
+  }
   IDEBUG ("inode reopen: %p(%d),sector=%d.\n", inode, inode->open_cnt, inode->sector);
   return inode;
 }
@@ -378,6 +995,38 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Writes the data sectors of INODE written since the last call to disk,
+   with its inode. */
+static void
+inode_flush_dirty (struct inode *inode)
+{
+  block_sector_t dirty[INODE_DIRTY_CNT];
+  int cnt, i;
+
+  // the sectors taken from the index stay locked until they are written,
+  // so that a concurrent fsync cannot find the index empty and return
+  // before them
+  lock_acquire (&inode->lock_flush);
+  lock_acquire (&inode->lock_dirty);
+  cnt = inode->dirty_cnt;
+  for (i = 0; i < cnt; i++)
+    dirty[i] = inode->dirty[i];
+  inode->dirty_cnt = 0;
+  lock_release (&inode->lock_dirty);
+
+  if (cnt < 0) {
+    // too many to remember, look up every sector of the file
+    acquire_shared (&inode->rw);
+    inode_flush (inode);
+    release_shared (&inode->rw);
+  } else {
+    for (i = 0; i < cnt; i++)
+      cache_flush_block (dirty[i]);
+    cache_flush_block (inode->sector);
+  }
+  lock_release (&inode->lock_flush);
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -388,81 +1037,117 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
-  // write all dirty pages to disk
-  inode_flush (inode);
   /* Release resources if this was the last opener. */
   IDEBUG ("inode before close: %p(%d),sector=%d.\n", inode, inode->open_cnt, inode->sector);
-  if (--inode->open_cnt == 0)
+  lock_acquire (&lock_open_inodes);
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      lock_release (&lock_open_inodes);
+      return;
+    }
+  /* Remove from the table of open inodes. */
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&lock_open_inodes);
+
+  /* Deallocate blocks if removed, writing the free map once; otherwise
+     write all dirty pages of the last opener to disk. */
+  if (inode->removed) {
+    journal_begin ();
+    free_map_batch_begin ();
+    inode_release (inode);
+    free_map_batch_end ();
+    journal_end ();
+  } else
+    inode_flush_dirty (inode);
+
+  map_free (inode);
+  free (inode); 
+}
+/* Returns true if SLOT of a sector table holds a sector, not a hole. */
+static bool
+slot_is_sector (block_sector_t slot)
+{
+  return slot != 0 && slot != BLOCK_ERROR;
+}
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
-	inode_release (inode);
+/* Frees the sectors in the CNT slots of the sector table starting at byte
+   TABLE_OFS of sector TABLE, and returns the number of sectors, or only
+   counts them if not RELEASE.  A slot that is itself a table is walked
+   DEPTH levels down, and freed with its sectors. */
+static size_t
+table_walk (block_sector_t table, size_t table_ofs, size_t cnt, int depth,
+	    bool release)
+{
+  struct cache_entry *buffer;
+  const block_sector_t *slots;
+  size_t i, sectors = 0;
+
+  slots = cache_read_get (table, CACHE_META, &buffer) + table_ofs;
+  for (i = 0; i < cnt; i++) {
+    if (!slot_is_sector (slots[i]))
+      continue;
+    if (depth > 0)
+      sectors += table_walk (slots[i], 0, BLOCK_SLOTS, depth - 1, release);
+    if (release)
+      free_map_release (slots[i], 1);
+    sectors++;
+  }
+  cache_read_put (buffer);
+  return sectors;
+}
+
+/* Frees the sectors of INODE, the index blocks and the data, and returns
+   their number, or only counts them if not RELEASE. */
+static size_t
+inode_walk (struct inode *inode, bool release)
+{
+  const struct inode_extents *ext = &inode->data.ext;
+  const struct inode_extent_leaf *leaf;
+  struct cache_entry *buffer;
+  size_t sectors = 0;
+  unsigned i, j;
+
+  if (!inode_is_extent (inode)) {
+    // DIRECT_BLK_LEN direct slots, then the indirect and the double
+    return (table_walk (inode->sector, offsetof (struct inode_disk, block),
+			DIRECT_BLK_LEN, 0, release)
+	    + table_walk (inode->sector, offsetof (struct inode_disk,
+						   block[INDIRECT_BLK]),
+			  1, 1, release)
+	    + table_walk (inode->sector, offsetof (struct inode_disk,
+						   block[DBL_INDIRECT_BLK]),
+			  1, 2, release));
+  }
 
-      free (inode); 
+  for (i = 0; i < ext->cnt; i++) {
+    if (ext->depth == 0) {
+      if (release)
+	free_map_release (ext->extents[i].start, ext->extents[i].length);
+      sectors += ext->extents[i].length;
+      continue;
     }
+    leaf = cache_read_get (ext->extents[i].start, CACHE_META, &buffer);
+    for (j = 0; j < leaf->cnt; j++) {
+      if (release)
+	free_map_release (leaf->extents[j].start, leaf->extents[j].length);
+      sectors += leaf->extents[j].length;
+    }
+    cache_read_put (buffer);
+    if (release)
+      free_map_release (ext->extents[i].start, 1);
+    sectors++;
+  }
+  return sectors;
 }
+
 /* free inode's disk blocks  */
 void inode_release(struct inode *inode) 
 {
   ASSERT (inode != NULL);
 
-  struct inode_indirect indirect, dbl_indirect;
-  block_sector_t indirect_idx = 0;
-  block_sector_t dbl_indirect_idx = 0;
-  block_sector_t direct_min, indirect_min, dbl_indirect_min, i;
-  block_sector_t sectors = bytes_to_sectors (inode_length (inode));
-  struct inode_disk *inode_data = &inode->data;
-
+  inode_walk (inode, true);
   // free inode itself
   free_map_release (inode->sector, 1);
-
-  // start to free inode data
-  direct_min = sectors < INDIRECT_BEGIN ? sectors : INDIRECT_BEGIN;
-  for (i = DIRECT_BEGIN; i < direct_min; i++) {
-    if (inode_data->block[i] != 0)
-      free_map_release (inode_data->block[i], 1);
-  }
-
-  indirect_min = sectors < DBL_INDIRECT_BEGIN ? sectors : DBL_INDIRECT_BEGIN;
-  for (i = INDIRECT_BEGIN; i < indirect_min; i++) {
-    if (i ==  INDIRECT_BLK && inode_data->block[i] != BLOCK_ERROR)
-      cache_block_read (fs_device, inode_data->block[INDIRECT_BLK],
-			&indirect);
-      
-    if (indirect.block[i] != 0)
-      free_map_release (indirect.block[i], 1);
-  }
-
-  dbl_indirect_min = sectors < MAX_FILE_SECTOR ? sectors : MAX_FILE_SECTOR;
-  for (i = DBL_INDIRECT_BEGIN; i < dbl_indirect_min; i++) {
-    indirect_idx = (i - DBL_INDIRECT_BEGIN) / BLOCK_SLOTS;
-    dbl_indirect_idx = (i - DBL_INDIRECT_BEGIN) % BLOCK_SLOTS;
-
-    // read the indirect segment
-    if (i ==  DBL_INDIRECT_BLK && inode_data->block[i] != BLOCK_ERROR)
-      cache_block_read (fs_device, inode_data->block[DBL_INDIRECT_BLK],
-			&indirect);
-    // read the double indirect segment
-    if (indirect_idx == 0 && indirect.block[indirect_idx] != BLOCK_ERROR)
-      cache_block_read (fs_device, indirect.block[indirect_idx], &dbl_indirect);
-
-    // free the sector
-    if (dbl_indirect.block[dbl_indirect_idx] != 0)
-      free_map_release (dbl_indirect.block[dbl_indirect_idx], 1);
-
-    // if it is the last sector in the double indirect segement, free the
-    // double indirect segement.
-    if (dbl_indirect_idx == (BLOCK_SLOTS - 1))
-      free_map_release (indirect.block[indirect_idx], 1);
-  }
-  // free the last double indirect segment and indirect segment
-  if (i == dbl_indirect_min) {
-      free_map_release (indirect.block[indirect_idx], 1);
-      free_map_release (inode_data->block[DBL_INDIRECT_BLK], 1);
-  }
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -478,138 +1163,140 @@ inode_remove (struct inode *inode)
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
 {
-  uint8_t *buffer = buffer_;
-  off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
-
-  while (size > 0) 
-    {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if (sector_idx == BLOCK_ERROR)
-	break;
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+  struct iovec iov;
 
-      /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return inode_readv_at (inode, &iov, 1, offset);
+}
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+/* Reads from INODE, starting at position OFFSET, into the CNT buffers
+   of IOV in turn, as one read.  Returns the number of bytes actually
+   read, which may be less than asked if an error occurs or end of file
+   is reached. */
+off_t
+inode_readv_at (struct inode *inode, const struct iovec *iov, int cnt,
+		off_t offset)
+{
+  uint8_t *buffer;
+  off_t size;
+  off_t bytes_read = 0;
+  struct cache_entry *cached;
+  const uint8_t *data;
+  enum intr_level old_level;
+  int i;
+
+  acquire_shared (&inode->rw);
+  old_level = intr_disable ();
+  if (reads_active++ > 0)
+    read_overlaps++;
+  intr_set_level (old_level);
+  for (i = 0; i < cnt; i++)
+    {
+      buffer = iov[i].iov_base;
+      for (size = iov[i].iov_len; size > 0; )
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          /* Disk sector to read, starting byte offset within sector. */
+          block_sector_t sector_idx = byte_to_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+
+          /* Bytes left in inode, bytes left in sector, lesser of the two. */
+          off_t inode_left = inode_length (inode) - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+          /* Number of bytes to actually copy out of this sector. */
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            break;
+
+          /* Copy straight out of the buffer cache into caller's buffer.
+             A hole reads as zeros. */
+          if (sector_idx == BLOCK_ERROR)
+            memset (buffer, 0, chunk_size);
+          else
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              data = cache_read_get (sector_idx, inode_class (inode), &cached);
+              memcpy (buffer, data + sector_ofs, chunk_size);
+              cache_read_put (cached);
             }
-          cache_block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_read += chunk_size;
         }
-      
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_read += chunk_size;
+      if (size > 0)
+        break;
     }
-  free (bounce);
+  old_level = intr_disable ();
+  reads_active--;
+  intr_set_level (old_level);
+  release_shared (&inode->rw);
 
   return bytes_read;
 }
 
-/* Expand SIZE bytes of zeros into INODE, starting at OFFSET.
-   Returns the number of bytes actually expanded and change inode length 
-   to the new value. */
+/* Returns a pointer to byte OFFSET of INODE in the buffer cache, which
+   stays valid up to the end of its sector until the buffer stored in
+   *BUFP is returned by inode_read_put.  Returns a null pointer if
+   OFFSET is past the end of INODE.  A hole reads as a sector of zeros
+   outside the buffer cache, with a null *BUFP. */
+const void *
+inode_read_get (struct inode *inode, off_t offset, struct cache_entry **bufp)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector_idx;
+
+  if (offset >= inode_length (inode))
+    return NULL;
+  sector_idx = byte_to_sector (inode, offset);
+  if (sector_idx == BLOCK_ERROR) {
+    *bufp = NULL;
+    return zeros + offset % BLOCK_SECTOR_SIZE;
+  }
+  return (cache_read_get (sector_idx, inode_class (inode), bufp)
+	  + offset % BLOCK_SECTOR_SIZE);
+}
+
+/* Returns a buffer obtained from inode_read_get. */
+void
+inode_read_put (struct cache_entry *buffer)
+{
+  if (buffer != NULL)
+    cache_read_put (buffer);
+}
+
+/* Expand SIZE bytes of zeros into INODE, starting at OFFSET, its end of
+   file.  Only the rest of the sector holding OFFSET is zeroed; the
+   sectors after it are left as a hole, which reads as zeros and gets
+   sectors when it is written.  Returns the number of bytes actually
+   expanded and change inode length to the new value. */
 off_t
 inode_expand_zero (struct inode *inode, off_t size, off_t offset) 
 {
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
   block_sector_t sector_idx;
-  block_sector_t pos_sector;
+  int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+  int chunk_size = BLOCK_SECTOR_SIZE - sector_ofs;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  if (sector_ofs > 0) {
+    sector_idx = byte_to_sector (inode, offset);
+    if (chunk_size > size)
+      chunk_size = size;
+    if (sector_idx != BLOCK_ERROR)
+      cache_block_write_at (sector_idx, NULL, sector_ofs, chunk_size, false,
+			    inode_class (inode));
+  }
   inode->data.length = offset + size;
-  cache_block_write (fs_device, inode->sector, &inode->data);
-
-  while (size > 0) 
-    {
-      /* Sector to write, starting byte offset within sector. */
-      sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-      if (sector_idx == BLOCK_ERROR) {
-	pos_sector = offset /  BLOCK_SECTOR_SIZE;
-	// mark the sector with zero sector
-	if (inode_expand_sector (inode, pos_sector))
-	  sector_idx = 0;
-	else
-	  break;
-      } 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
-
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Mark the sector with zero sector, which is done in the begining
-	     of the while loop. */
-        }
-      else 
-        {
-	  // allocate a zeros sector
-	  if (sector_idx == 0)
-	    sector_idx = byte_to_sector (inode, offset);
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memset (bounce + sector_ofs, 0, chunk_size);
-          cache_block_write (fs_device, sector_idx, bounce);
-        }
-
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
-    }
-  // set the length of inode to new offset
-  inode->data.length = offset;
-  free (bounce);
+  cache_block_write (fs_device, inode->sector, &inode->data, CACHE_META);
 
-  return bytes_written;
+  return size;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
@@ -618,95 +1305,323 @@ inode_expand_zero (struct inode *inode, off_t size, off_t offset)
    (Normally a write at end of file would extend the inode, but
    growth is not yet implemented.) */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
-  off_t inode_size = inode_length (inode);
-  block_sector_t sector_idx;
-  block_sector_t pos_sector;
+  struct iovec iov;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  iov.iov_base = (void *) buffer;
+  iov.iov_len = size;
+  return inode_writev_at (inode, &iov, 1, offset);
+}
 
+/* Records that data SECTOR of INODE has been written, or if SECTOR is
+   BLOCK_ERROR that the length or the map of INODE changed, for
+   inode_sync. */
+static void
+mark_dirty (struct inode *inode, block_sector_t sector)
+{
+  lock_acquire (&inode->lock_dirty);
+  if (sector == BLOCK_ERROR)
+    {
+      inode->meta_dirty = true;
+      inode->meta_gen++;
+    }
+  else if (inode_class (inode) == CACHE_DATA && inode->dirty_cnt >= 0
+	   && (inode->dirty_cnt == 0
+	       || inode->dirty[inode->dirty_cnt - 1] != sector))
+    {
+      // a write of several chunks into one sector records it once
+      if (inode->dirty_cnt < INODE_DIRTY_CNT)
+	inode->dirty[inode->dirty_cnt++] = sector;
+      else
+	inode->dirty_cnt = -1;
+    }
+  lock_release (&inode->lock_dirty);
+}
+
+/* Locks INODE for a write of SIZE bytes at OFFSET.  A write inside the
+   file shares INODE with the readers and the other writers, each sector
+   being locked in the buffer cache.  A write that grows the file holds
+   INODE alone until its data is written, so that nobody reads the new
+   sectors before.  Returns true if the write grows the file. */
+static bool
+write_lock (struct inode *inode, off_t offset, off_t size)
+{
+  bool grow;
+
+  acquire_shared (&inode->rw);
+  grow = offset + size > inode_length (inode);
+  if (grow) {
+    release_shared (&inode->rw);
+    acquire_exclusive (&inode->rw);
+  }
+  return grow;
+}
+
+/* Unlocks INODE locked by write_lock, which returned GROW. */
+static void
+write_unlock (struct inode *inode, bool grow)
+{
+  if (grow)
+    release_exclusive (&inode->rw);
+  else
+    release_shared (&inode->rw);
+}
+
+/* Makes room in INODE, locked by write_lock, for a write of SIZE bytes
+   at OFFSET, and returns the length of the file before.  If the disk
+   runs out of space, the file is only extended as far as the sectors
+   could be allocated. */
+static off_t
+write_prepare (struct inode *inode, off_t offset, off_t size)
+{
+  off_t inode_size = inode_length (inode);
+  block_sector_t first, mapped;
+  off_t end;
+
+  if (inode_is_extent (inode)) {
+    // allocate the sectors the write is about to fill past the end of file
+    // in long runs, leaving a hole before the write
+    lock_acquire (&inode->lock_map);
+    first = offset / BLOCK_SECTOR_SIZE;
+    mapped = extent_end (&inode->data.ext);
+    if (first < mapped)
+      first = mapped;
+    if (first < bytes_to_sectors (inode_size))
+      first = bytes_to_sectors (inode_size);
+    if (!extent_grow (inode, first, bytes_to_sectors (offset + size), false))
+      {
+        // the write ends where the allocated sectors do
+        end = (off_t) extent_end (&inode->data.ext) * BLOCK_SECTOR_SIZE;
+        if (end < offset + size)
+          size = end > offset ? end - offset : 0;
+      }
+    lock_release (&inode->lock_map);
+  }
   if (offset > inode_size) {
-    inode_lock (inode);
     inode_expand_zero (inode, offset + size - inode_size, inode_size);
-    inode_unlock (inode);
+    if (inode_size % BLOCK_SECTOR_SIZE != 0)
+      mark_dirty (inode, byte_to_sector (inode, inode_size));
   }
-
   if ((offset + size) > inode_length (inode)) {
-    inode_lock (inode);
     inode->data.length = offset + size;
-    cache_block_write (fs_device, inode->sector, &inode->data);
-    inode_unlock (inode);
+    cache_block_write (fs_device, inode->sector, &inode->data, CACHE_META);
   }
-  while (size > 0) 
-    {
-      /* Sector to write, starting byte offset within sector. */
-      sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-      if (sector_idx == BLOCK_ERROR) {
-	pos_sector = offset / BLOCK_SECTOR_SIZE;
-	if (inode_expand_sector (inode, pos_sector))
-	  sector_idx = byte_to_sector (inode, offset);
-	else
-	  break;
-	//re-read the inode_disk
-	cache_block_read (fs_device, inode->sector, &inode->data);
-      }
+  if (offset + size > inode_size)
+    mark_dirty (inode, BLOCK_ERROR);
+  return inode_size;
+}
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+/* Returns the sector of INODE to write at OFFSET, giving a hole a
+   sector of zeros, or BLOCK_ERROR if the disk is full. */
+static block_sector_t
+write_sector (struct inode *inode, off_t offset)
+{
+  block_sector_t sector_idx = byte_to_sector (inode, offset);
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+  if (sector_idx == BLOCK_ERROR
+      && inode_expand_sector (inode, offset / BLOCK_SECTOR_SIZE)) {
+    sector_idx = byte_to_sector (inode, offset);
+    mark_dirty (inode, BLOCK_ERROR);
+  }
+  return sector_idx;
+}
+
+/* Writes the inode of INODE at the end of a write, which found the file
+   INODE_SIZE bytes long and wrote up to END, or nothing if END is
+   INODE_SIZE.  A write that grew the file but stopped short, because the
+   disk is full, leaves it only as long as what was written. */
+static void
+write_finish (struct inode *inode, off_t inode_size, off_t end)
+{
+  if (end < inode_size)
+    end = inode_size;
+  // set the length of inode to new offset
+  lock_acquire (&inode->lock_map);
+  if (inode->data.length > end)
+    inode->data.length = end;
+  cache_block_write (fs_device, inode->sector, &inode->data, CACHE_META);
+  lock_release (&inode->lock_map);
+}
+
+/* Writes the CNT buffers of IOV in turn into INODE, starting at OFFSET,
+   as one write: the file grows once, and no other write comes between
+   the buffers.  Returns the number of bytes actually written, which may
+   be less than asked if an error occurs. */
+off_t
+inode_writev_at (struct inode *inode, const struct iovec *iov, int cnt,
+		 off_t offset)
+{
+  const uint8_t *buffer;
+  off_t size = 0;
+  off_t bytes_written = 0;
+  off_t start = offset;
+  off_t inode_size;
+  block_sector_t sector_idx;
+  bool grow;
+  int i;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+  for (i = 0; i < cnt; i++)
+    size += iov[i].iov_len;
+
+  journal_begin ();
+  grow = write_lock (inode, offset, size);
+  if (inode->deny_write_cnt)
+    goto done;
+
+  inode_size = write_prepare (inode, offset, size);
+  for (i = 0; i < cnt; i++)
+    {
+      buffer = iov[i].iov_base;
+      for (size = iov[i].iov_len; size > 0; )
         {
-          /* Write full sector directly to disk. */
-          cache_block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Sector to write, starting byte offset within sector. */
+          sector_idx = write_sector (inode, offset);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+          if (sector_idx == BLOCK_ERROR)
+            break;
+
+          /* Bytes left in inode, bytes left in sector, lesser of the two. */
+          off_t inode_left = inode_length (inode) - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+
+          /* Number of bytes to actually write into this sector. */
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            break;
+
+          /* Update the chunk in place in the buffer cache, which reads the
+             sector first only if it may hold data around the chunk.  A
+             sector past the end of file is cleared on its first chunk. */
+          cache_block_write_at (sector_idx, buffer, sector_ofs, chunk_size,
+                                offset - sector_ofs >= inode_size
+                                && (offset == start || sector_ofs == 0),
+                                inode_class (inode));
+          mark_dirty (inode, sector_idx);
+
+          /* Advance. */
+          size -= chunk_size;
+          offset += chunk_size;
+          buffer += chunk_size;
+          bytes_written += chunk_size;
         }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
+      if (size > 0)
+        break;
+    }
+  write_finish (inode, inode_size, bytes_written > 0 ? offset : inode_size);
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) { 
-            cache_block_read (fs_device, sector_idx, bounce);
-	  }
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_block_write (fs_device, sector_idx, bounce);
-        }
+ done:
+  write_unlock (inode, grow);
+  journal_end ();
 
-      /* Advance. */
+  return bytes_written;
+}
+
+/* Copies SIZE bytes of INODE at SRC_OFS to DST_OFS, a range that does
+   not overlap, a sector at a time through a bounce buffer, since the
+   two ranges may share a sector.  Returns the number of bytes copied. */
+static off_t
+inode_copy_within (struct inode *inode, off_t dst_ofs, off_t src_ofs,
+		   off_t size)
+{
+  uint8_t *bounce = malloc (BLOCK_SECTOR_SIZE);
+  off_t bytes_copied = 0;
+  off_t chunk_size, bytes;
+
+  if (bounce == NULL)
+    return 0;
+  while (size > 0)
+    {
+      chunk_size = size < BLOCK_SECTOR_SIZE ? size : BLOCK_SECTOR_SIZE;
+      bytes = inode_read_at (inode, bounce, chunk_size, src_ofs);
+      if (bytes > 0)
+        bytes = inode_write_at (inode, bounce, bytes, dst_ofs);
+      bytes_copied += bytes;
+      if (bytes < chunk_size)
+        break;
       size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
+      src_ofs += chunk_size;
+      dst_ofs += chunk_size;
     }
-  // set the length of inode to new offset
-  inode_lock (inode);
-  cache_block_write (fs_device, inode->sector, &inode->data);
-  inode_unlock (inode);
   free (bounce);
+  return bytes_copied;
+}
 
-  return bytes_written;
+/* Copies SIZE bytes of SRC starting at SRC_OFS into DST starting at
+   DST_OFS, as one write of DST, and returns the number of bytes copied,
+   fewer than SIZE past the end of SRC.  Each chunk goes straight from
+   the cached sector of SRC to that of DST; a hole of SRC is written as
+   zeros.  Both inodes are locked in the order of their sectors, so that
+   copies in opposite directions do not deadlock. */
+off_t
+inode_copy_at (struct inode *dst, off_t dst_ofs, struct inode *src,
+	       off_t src_ofs, off_t size)
+{
+  off_t bytes_copied = 0;
+  off_t src_size = inode_length (src);
+  off_t inode_size;
+  block_sector_t from, to;
+  bool grow;
+
+  if (src == dst)
+    return inode_copy_within (dst, dst_ofs, src_ofs, size);
+
+  // a file never shrinks, so the length read unlocked is safe
+  if (size > src_size - src_ofs)
+    size = src_size > src_ofs ? src_size - src_ofs : 0;
+  if (size == 0)
+    return 0;
+
+  journal_begin ();
+  if (src->sector < dst->sector)
+    acquire_shared (&src->rw);
+  grow = write_lock (dst, dst_ofs, size);
+  if (src->sector > dst->sector)
+    acquire_shared (&src->rw);
+  if (dst->deny_write_cnt)
+    goto done;
+
+  inode_size = write_prepare (dst, dst_ofs, size);
+  while (size > 0)
+    {
+      int dst_sector_ofs = dst_ofs % BLOCK_SECTOR_SIZE;
+      int src_sector_ofs = src_ofs % BLOCK_SECTOR_SIZE;
+      int dst_left = BLOCK_SECTOR_SIZE - dst_sector_ofs;
+      int src_left = BLOCK_SECTOR_SIZE - src_sector_ofs;
+      int chunk_size = dst_left < src_left ? dst_left : src_left;
+      bool fresh = (dst_ofs - dst_sector_ofs >= inode_size
+                    && (bytes_copied == 0 || dst_sector_ofs == 0));
+
+      if (chunk_size > size)
+        chunk_size = size;
+      to = write_sector (dst, dst_ofs);
+      if (to == BLOCK_ERROR)
+        break;
+      from = byte_to_sector (src, src_ofs);
+      if (from == BLOCK_ERROR)
+        cache_block_write_at (to, NULL, dst_sector_ofs, chunk_size, fresh,
+                              inode_class (dst));
+      else
+        cache_block_copy (to, dst_sector_ofs, from, src_sector_ofs,
+                          chunk_size, fresh, inode_class (dst));
+      mark_dirty (dst, to);
+
+      /* Advance. */
+      size -= chunk_size;
+      dst_ofs += chunk_size;
+      src_ofs += chunk_size;
+      bytes_copied += chunk_size;
+    }
+  write_finish (dst, inode_size, bytes_copied > 0 ? dst_ofs : inode_size);
+
+ done:
+  release_shared (&src->rw);
+  write_unlock (dst, grow);
+  journal_end ();
+
+  return bytes_copied;
 }
 
 /* Disables writes to INODE.
@@ -714,8 +1629,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  acquire_exclusive (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  release_exclusive (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -724,9 +1641,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  acquire_exclusive (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  release_exclusive (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -736,6 +1655,48 @@ inode_length (const struct inode *inode)
   return inode->data.length;
 }
 
+/* Returns the number of sectors allocated to INODE, its data and index
+   blocks, which is less than its length in sectors if it has holes. */
+size_t
+inode_allocated (struct inode *inode)
+{
+  size_t sectors;
+
+  lock_acquire (&inode->lock_map);
+  sectors = inode_walk (inode, false);
+  lock_release (&inode->lock_map);
+  return sectors;
+}
+
+/* Returns the number of data sectors of INODE that are delayed write in
+   the buffer cache.  The metadata is not counted, since it is made
+   durable by the journal rather than written in place. */
+int
+inode_dirty (struct inode *inode)
+{
+  block_sector_t sectors, sector, i;
+  int cnt = 0;
+
+  acquire_shared (&inode->rw);
+  sectors = bytes_to_sectors (inode->data.length);
+  for (i = 0; i < sectors; i++) {
+    sector = byte_to_sector (inode, i * BLOCK_SECTOR_SIZE);
+    if (sector != BLOCK_ERROR && cache_is_delayed (sector))
+      cnt++;
+  }
+  release_shared (&inode->rw);
+  return cnt;
+}
+
+/* Copies the statistics of the inodes to *ST. */
+void
+inode_get_stats (struct fsstat *st)
+{
+  st->read_overlaps = read_overlaps;
+  st->open_lookups = open_lookups;
+  st->open_probes = open_probes;
+}
+
 /* Returns the open count of INODE. */
 int
 inode_open_cnt (const struct inode *inode)
@@ -743,11 +1704,56 @@ inode_open_cnt (const struct inode *inode)
   return inode->open_cnt;
 }
 
+/* Returns the offset of INODE, a directory, before which all the
+   entries are known to be in use. */
+off_t
+inode_free_slot (const struct inode *inode)
+{
+  return inode->free_slot;
+}
+
+/* Sets the offset returned by inode_free_slot to OFS. */
+void
+inode_set_free_slot (struct inode *inode, off_t ofs)
+{
+  inode->free_slot = ofs;
+}
+
 /* Returns true if inode is a directory */
 bool inode_is_dir (const struct inode *inode)
 {
   return inode != NULL && inode->data.is_dir != 0 ? true : false;
 }
+/* Makes the data written to INODE durable, then its metadata: the
+   running journal transaction is committed unless DATA_ONLY and
+   neither the length nor the sectors of INODE changed, for fsync and
+   fdatasync.  The metadata counts as clean only once the transaction
+   has committed, and only if it did not change again meanwhile, so a
+   concurrent fdatasync cannot return before it is durable.  The caller
+   holds no lock of the file system. */
+void
+inode_sync (struct inode *inode, bool data_only)
+{
+  unsigned gen;
+  bool meta;
+
+  lock_acquire (&inode->lock_dirty);
+  meta = inode->meta_dirty;
+  gen = inode->meta_gen;
+  lock_release (&inode->lock_dirty);
+
+  inode_flush_dirty (inode);
+  if (meta || !data_only)
+    journal_sync ();
+
+  if (meta) {
+    lock_acquire (&inode->lock_dirty);
+    if (inode->meta_gen == gen)
+      inode->meta_dirty = false;
+    lock_release (&inode->lock_dirty);
+  }
+}
+
 /* flush all dirty sectors of the inode to disk */
 void
 inode_flush (struct inode *inode) 
@@ -755,37 +1761,59 @@ inode_flush (struct inode *inode)
   block_sector_t sectors;   // number of sectors of an inode
   block_sector_t sector;    // the sector number of the disk block
   block_sector_t i;         // index of a loop 
-  struct cache_entry *buffer; //buffer cache
 
   // flush inode
-  buffer = cache_lookup (inode->sector);
-  if (buffer != NULL) {
-    if (buffer_is_delayed(buffer)) {
-      acquire_shared (&buffer->lock_shared);	
-      cache_flush_buffer (buffer);
-      release_shared (&buffer->lock_shared);
-    }
-  }
+  cache_flush_block (inode->sector);
 
   // flush inode data
   sectors = bytes_to_sectors (inode->data.length);
   for (i = 0; i < sectors; i++) {
     sector = byte_to_sector (inode, i * BLOCK_SECTOR_SIZE);
-    buffer = cache_lookup (sector);
-    if (buffer != NULL) {
-      if (buffer_is_delayed(buffer)) {
-	acquire_shared (&buffer->lock_shared);
-	cache_flush_buffer (buffer);
-	release_shared (&buffer->lock_shared);
-      }
-    }
+    if (sector != BLOCK_ERROR)
+      cache_flush_block (sector);
   } 
 }
 
+/* Queue the sectors of INODE holding bytes START up to END, or up to the
+   end of file, to be read ahead into the buffer cache. */
+void
+inode_readahead (struct inode *inode, off_t start, off_t end)
+{
+  block_sector_t sector;
+  off_t ofs;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (ofs = ROUND_DOWN (start, BLOCK_SECTOR_SIZE); ofs < end;
+       ofs += BLOCK_SECTOR_SIZE) {
+    sector = byte_to_sector (inode, ofs);
+    if (sector != BLOCK_ERROR)
+      cache_readahead (sector, inode_class (inode));
+  }
+}
+
+/* Returns true if the sector holding byte POS of INODE is in the buffer
+   cache, or is a hole, which is read without the disk.  *PREFETCHED is
+   set to whether the sector was read ahead and not used since. */
+bool
+inode_is_cached (struct inode *inode, off_t pos, bool *prefetched)
+{
+  block_sector_t sector;
+
+  *prefetched = false;
+  if (pos >= inode_length (inode))
+    return false;
+  sector = byte_to_sector (inode, pos);
+  return sector == BLOCK_ERROR || cache_is_cached (sector, prefetched);
+}
+
+/* Locks INODE, a directory, while its entries are searched or changed;
+   see directory.c. */
 void inode_lock (struct inode *inode)
 {
   lock_acquire (&inode->lock_inode);
 }
+/* Unlocks INODE locked by inode_lock. */
 void inode_unlock (struct inode *inode)
 {
   lock_release (&inode->lock_inode);
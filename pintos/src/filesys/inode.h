@@ -22,6 +22,12 @@
 #define BLOCK_ERROR ((block_sector_t) -1) 
 
 struct bitmap;
+struct cache_entry;
+struct iovec;
+struct fsstat;
+
+/* Create new inodes in the extent format, set by -inode-format. */
+extern bool inode_extents;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, bool is_dir);
@@ -32,17 +38,34 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_readv_at (struct inode *, const struct iovec *, int cnt,
+		      off_t offset);
+off_t inode_writev_at (struct inode *, const struct iovec *, int cnt,
+		       off_t offset);
+off_t inode_copy_at (struct inode *dst, off_t dst_ofs, struct inode *src,
+		     off_t src_ofs, off_t size);
+const void *inode_read_get (struct inode *, off_t offset,
+			    struct cache_entry **bufp);
+void inode_read_put (struct cache_entry *buffer);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 bool inode_is_dir (const struct inode *inode);
+off_t inode_free_slot (const struct inode *inode);
+void inode_set_free_slot (struct inode *inode, off_t ofs);
+size_t inode_allocated (struct inode *inode);
+int inode_dirty (struct inode *inode);
+void inode_get_stats (struct fsstat *st);
 int inode_open_cnt (const struct inode *inode);
 void inode_flush (struct inode *inode);
-block_sector_t inode_alloc_zeros (block_sector_t *sector);
+void inode_sync (struct inode *inode, bool data_only);
+block_sector_t inode_alloc_zeros (block_sector_t goal, block_sector_t *sector);
 bool inode_expand_sector (struct inode *inode, block_sector_t pos_sector);
 off_t inode_expand_zero (struct inode *inode, off_t size, off_t offset);
 void inode_release (struct inode *inode);
 struct inode *inode_open_path (const char *path_name, char *file_name);
+void inode_readahead (struct inode *inode, off_t start, off_t end);
+bool inode_is_cached (struct inode *inode, off_t pos, bool *prefetched);
 void inode_lock (struct inode *inode);
 void inode_unlock (struct inode *inode);
 
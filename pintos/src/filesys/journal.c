@@ -0,0 +1,590 @@
+/* pintos/src/filesys/journal.c
+   Write-ahead journal of the metadata: inodes, sector tables, the free
+   map and directories.  A metadata buffer changed in the buffer cache
+   joins the running transaction, and it is not written to its home
+   sector before the transaction is committed to the log.  A crash then
+   leaves every committed transaction whole in the log, and boot copies
+   them home before the file system is used.  The contents of regular
+   files are not journaled.
+
+   File system operations run between journal_begin and journal_end, and
+   a transaction is closed only when no operation is halfway, so that it
+   holds whole operations.  Commits are grouped: the write-behind daemon
+   commits the running transaction every CACHE_FLUSH_SLICE, or an
+   operation does when it is half full, so a single log write covers the
+   metadata of many system calls however often each sector changed.
+   When the log is full, the newest copy of each sector in it is written
+   home (a checkpoint) and the log starts over.
+
+   On disk, JOURNAL_SECTOR holds the header and the log takes the
+   following LOG_CNT sectors as a circular buffer of records.  A record
+   is a descriptor listing the home sectors, the copies of the sectors,
+   and a commit block; a record whose commit block is missing was never
+   committed. */
+#include "filesys/journal.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define JOURNAL_MAGIC  0x4c4e524a  /* "JRNL", journal header */
+#define JOURNAL_DESC   0x43534544  /* "DESC", record descriptor */
+#define JOURNAL_COMMIT 0x54494d43  /* "CMIT", record commit block */
+
+#define LOG_START (JOURNAL_SECTOR + 1)  /* first sector of the log */
+#define LOG_CNT (JOURNAL_SECTORS - 1)   /* sectors in the log */
+
+/* Journal header, the first record of the log to replay. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence of that record. */
+    uint32_t start;                     /* Its position in the log. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+  };
+
+/* First sector of a record, followed by the copies of CNT sectors. */
+struct journal_desc
+  {
+    uint32_t magic;                     /* JOURNAL_DESC. */
+    uint32_t seq;                       /* Sequence of the transaction. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[JOURNAL_TXN_MAX]; /* Their home sectors. */
+  };
+
+/* Last sector of a record, written once the rest is on disk. */
+struct journal_commit
+  {
+    uint32_t magic;                     /* JOURNAL_COMMIT. */
+    uint32_t seq;                       /* Sequence of the transaction. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* A copy of a sector in the log, not yet written home. */
+struct journal_live
+  {
+    block_sector_t sector;              /* Home sector. */
+    size_t pos;                         /* Position of the copy. */
+  };
+
+/* Sectors released while the log still held them.  They are only given
+   back to the free map once they are out of the log, so that a replay
+   cannot overwrite them after they were reused. */
+struct journal_free
+  {
+    struct list_elem elem;              /* Element in list_free. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+static bool journal_on;                 /* the journal is in use */
+static struct lock lock_journal;        /* lock when accessing the below */
+static struct cache_entry *txn[JOURNAL_TXN_MAX]; /* running transaction */
+static size_t txn_cnt;                  /* number of buffers in txn */
+static bool txn_overflow;               /* txn ran out of room */
+static unsigned running_seq;            /* sequence of txn */
+static int handles;                     /* operations inside txn */
+static bool closing;                    /* txn is closed to new operations */
+static bool forced;                     /* commit without waiting for them */
+static struct condition cond_drained;   /* no operation is left */
+static struct condition cond_open;      /* txn is open again */
+static block_sector_t committing[JOURNAL_TXN_MAX]; /* txn being logged */
+static size_t committing_cnt;           /* number of sectors in it */
+static struct journal_live live[LOG_CNT]; /* copies in the log */
+static size_t live_cnt;                 /* number of copies in live */
+static struct list list_free;           /* journal_free waiting for the log */
+
+/* Only one transaction is committed at a time, by the holder of
+   lock_commit, which owns the fields below. */
+static struct lock lock_commit;
+static volatile unsigned committed_seq; /* last transaction committed */
+static size_t log_head;                 /* position of the next record */
+static size_t log_used;                 /* sectors used since checkpoint */
+static void *record;                    /* the record being written */
+
+static void journal_flush_log (void);
+static void journal_release_pending (void);
+static void commit (bool wait);
+
+/* Writes CNT sectors of DATA to the log starting at position POS,
+   wrapping around at its end. */
+static void
+log_write (size_t pos, const void *data, size_t cnt)
+{
+  size_t n = cnt < LOG_CNT - pos ? cnt : LOG_CNT - pos;
+
+  block_write_sectors (fs_device, LOG_START + pos, data, n);
+  if (n < cnt)
+    block_write_sectors (fs_device, LOG_START,
+			 (const uint8_t *) data + n * BLOCK_SECTOR_SIZE,
+			 cnt - n);
+}
+
+/* Reads CNT sectors of the log starting at position POS into DATA,
+   wrapping around at its end. */
+static void
+log_read (size_t pos, void *data, size_t cnt)
+{
+  size_t n = cnt < LOG_CNT - pos ? cnt : LOG_CNT - pos;
+
+  block_read_sectors (fs_device, LOG_START + pos, data, n);
+  if (n < cnt)
+    block_read_sectors (fs_device, LOG_START,
+			(uint8_t *) data + n * BLOCK_SECTOR_SIZE, cnt - n);
+}
+
+/* Writes the journal header: replay starts at position START with the
+   record of sequence SEQ. */
+static void
+journal_write_header (size_t start, unsigned seq)
+{
+  static struct journal_header header;
+
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = seq;
+  header.start = start;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Creates an empty journal while formatting the file system. */
+void
+journal_create (void)
+{
+  void *zeros;
+
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) <= BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == BLOCK_SECTOR_SIZE);
+
+  /* Clear the log, a record left by an older file system must not look
+     committed. */
+  zeros = calloc (LOG_CNT, BLOCK_SECTOR_SIZE);
+  if (zeros == NULL)
+    PANIC ("journal creation failed");
+  log_write (0, zeros, LOG_CNT);
+  free (zeros);
+  journal_write_header (0, 1);
+}
+
+/* Copies the committed records of the log home, then opens the journal
+   for new transactions.  A disk without a journal is used without one. */
+void
+journal_open (void)
+{
+  struct journal_header header;
+  struct journal_desc *desc;
+  struct journal_commit *commit;
+  size_t pos, used = 0, i;
+  unsigned seq;
+  int replayed = 0;
+
+  lock_init (&lock_journal);
+  lock_init (&lock_commit);
+  cond_init (&cond_drained);
+  cond_init (&cond_open);
+  list_init (&list_free);
+  txn_cnt = committing_cnt = live_cnt = 0;
+  handles = 0;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC || header.start >= LOG_CNT)
+    {
+      printf ("filesys: no journal, metadata is not journaled\n");
+      return;
+    }
+  record = malloc ((JOURNAL_TXN_MAX + 1) * BLOCK_SECTOR_SIZE);
+  if (record == NULL)
+    PANIC ("journal allocation failed");
+
+  /* Replay the records in order while they are whole, so the newest
+     copy of a sector ends up home. */
+  desc = record;
+  commit = (struct journal_commit *) ((uint8_t *) record
+				      + BLOCK_SECTOR_SIZE);
+  for (pos = header.start, seq = header.seq; ; seq++)
+    {
+      log_read (pos, desc, 1);
+      if (desc->magic != JOURNAL_DESC || desc->seq < seq
+	  || desc->cnt == 0 || desc->cnt > JOURNAL_TXN_MAX
+	  || used + desc->cnt + 2 > LOG_CNT)
+	break;
+      seq = desc->seq;
+      log_read ((pos + 1 + desc->cnt) % LOG_CNT, commit, 1);
+      if (commit->magic != JOURNAL_COMMIT || commit->seq != seq)
+	break;
+      for (i = 0; i < desc->cnt; i++)
+	{
+	  if (desc->sectors[i] >= block_size (fs_device))
+	    PANIC ("journal record %u is corrupt", seq);
+	  log_read ((pos + 1 + i) % LOG_CNT, commit, 1);
+	  block_write (fs_device, desc->sectors[i], commit);
+	}
+      used += desc->cnt + 2;
+      pos = (pos + desc->cnt + 2) % LOG_CNT;
+      replayed++;
+    }
+  if (replayed > 0)
+    printf ("filesys: replayed %d journal transactions\n", replayed);
+
+  journal_write_header (pos, seq);
+  log_head = pos;
+  log_used = 0;
+  running_seq = seq;
+  committed_seq = seq - 1;
+  journal_on = true;
+}
+
+/* Commits the running transaction and stops journaling, when the file
+   system is shut down. */
+void
+journal_close (void)
+{
+  if (!journal_on)
+    return;
+  journal_flush_log ();
+  journal_release_pending ();
+  journal_flush_log ();
+  journal_on = false;
+}
+
+/* Starts a file system operation, which must end with journal_end.
+   Operations nest; only the outermost one waits for a transaction that
+   is being closed. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0 || !journal_on)
+    return;
+  lock_acquire (&lock_journal);
+  while (closing)
+    cond_wait (&cond_open, &lock_journal);
+  handles++;
+  lock_release (&lock_journal);
+}
+
+/* Ends an operation started by journal_begin.  The outermost one gives
+   back the sectors whose release waited for the log, and commits if the
+   running transaction is half full. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool due;
+
+  ASSERT (t->journal_depth > 0);
+  if (t->journal_depth == 1 && journal_on)
+    journal_release_pending ();
+  if (--t->journal_depth > 0 || !journal_on)
+    return;
+  lock_acquire (&lock_journal);
+  if (--handles == 0)
+    cond_signal (&cond_drained, &lock_journal);
+  due = txn_cnt >= JOURNAL_TXN_MAX / 2 || txn_overflow;
+  lock_release (&lock_journal);
+  if (due)
+    commit (true);
+}
+
+/* Commits the running transaction if it holds anything, every
+   CACHE_FLUSH_SLICE. */
+void
+journal_tick (void)
+{
+  if (journal_on && txn_cnt > 0)
+    commit (true);
+}
+
+/* Commits the running transaction, and returns once it is in the log,
+   for fsync.  The caller holds no lock of the file system. */
+void
+journal_sync (void)
+{
+  commit (true);
+}
+
+/* Adds a metadata BUFFER that has just been changed, and that its caller
+   holds exclusively, to the running transaction.  If the transaction
+   has no room left, the buffer waits for the next commit, which first
+   checkpoints the log so that no older copy of it can be replayed. */
+void
+journal_add (struct cache_entry *buffer)
+{
+  if (!journal_on)
+    return;
+  lock_acquire (&lock_journal);
+  if (buffer->jseq != running_seq)
+    {
+      buffer->jseq = running_seq;
+      if (txn_cnt < JOURNAL_TXN_MAX)
+	txn[txn_cnt++] = buffer;
+      else
+	txn_overflow = true;
+    }
+  lock_release (&lock_journal);
+}
+
+/* Returns true if BUFFER has changes that are not committed yet, so it
+   must not be written home. */
+bool
+journal_pending (struct cache_entry *buffer)
+{
+  return journal_on && buffer->jseq > committed_seq;
+}
+
+/* Writes the newest copy of each sector in the log home, then empties
+   the log; the next record, of sequence SEQ, goes where the last one
+   ended.  The caller holds lock_commit. */
+static void
+journal_checkpoint (unsigned seq)
+{
+  static uint8_t copy[BLOCK_SECTOR_SIZE];
+  size_t i, j;
+
+  for (i = live_cnt; i-- > 0; )
+    {
+      for (j = i + 1; j < live_cnt; j++)
+	if (live[j].sector == live[i].sector)
+	  break;
+      if (j < live_cnt)
+	continue;             // a later copy is written instead
+      log_read (live[i].pos, copy, 1);
+      block_write (fs_device, live[i].sector, copy);
+    }
+  journal_write_header (log_head, seq);
+  lock_acquire (&lock_journal);
+  live_cnt = 0;
+  lock_release (&lock_journal);
+  log_used = 0;
+}
+
+/* Commits the running transaction at once, for a thread that must write
+   a buffer to evict it, even if an operation is split between two
+   transactions.  The thread may hold any lock of the file system. */
+void
+journal_commit (void)
+{
+  commit (false);
+}
+
+/* Commits the running transaction to the log.  If WAIT, the caller holds
+   no lock of the file system and is not inside an operation, and the
+   transaction is committed once no operation is halfway through it. */
+static void
+commit (bool wait)
+{
+  static struct journal_commit cblock;
+  struct journal_desc *desc = record;
+  struct cache_entry *buffer;
+  struct cache_entry *busy[JOURNAL_TXN_MAX];
+  size_t cnt, busy_cnt = 0, i;
+  bool overflow;
+  unsigned seq;
+
+  if (!journal_on || lock_held_by_current_thread (&lock_commit))
+    return;
+  if (!wait)
+    {
+      // do not keep a commit in progress waiting for this thread
+      lock_acquire (&lock_journal);
+      forced = true;
+      cond_signal (&cond_drained, &lock_journal);
+      lock_release (&lock_journal);
+    }
+  lock_acquire (&lock_commit);
+
+  /* Close the transaction to new operations and wait for the running
+     ones, then take its buffers. */
+  lock_acquire (&lock_journal);
+  if (!wait)
+    forced = true;
+  closing = true;
+  while (handles > 0 && !forced)
+    cond_wait (&cond_drained, &lock_journal);
+  forced = false;
+  seq = running_seq++;
+  cnt = txn_cnt;
+  overflow = txn_overflow;
+  txn_cnt = 0;
+  txn_overflow = false;
+  for (i = 0; i < cnt; i++)
+    committing[i] = txn[i]->sector;
+  committing_cnt = cnt;
+  lock_release (&lock_journal);
+
+  /* Copy the buffers into the record.  One held exclusively by a thread
+     forcing the commit is being changed, so it moves to the next
+     transaction. */
+  memset (desc, 0, BLOCK_SECTOR_SIZE);
+  for (i = 0; i < cnt; i++)
+    {
+      buffer = txn[i];
+      if (!try_acquire_shared (&buffer->lock_shared))
+	{
+	  busy[busy_cnt++] = buffer;
+	  continue;
+	}
+      desc->sectors[desc->cnt] = buffer->sector;
+      memcpy ((uint8_t *) record + ++desc->cnt * BLOCK_SECTOR_SIZE,
+	      buffer->data, BLOCK_SECTOR_SIZE);
+      release_shared (&buffer->lock_shared);
+    }
+
+  lock_acquire (&lock_journal);
+  for (i = 0; i < busy_cnt; i++)
+    if (busy[i]->jseq != running_seq)
+      {
+	busy[i]->jseq = running_seq;
+	if (txn_cnt < JOURNAL_TXN_MAX)
+	  txn[txn_cnt++] = busy[i];
+	else
+	  txn_overflow = true;
+      }
+  closing = false;
+  cond_broadcast (&cond_open, &lock_journal);
+  lock_release (&lock_journal);
+
+  /* Make room in the log, or drop the older copies of a sector that
+     overflowed a transaction. */
+  if (overflow || log_used + desc->cnt + 2 > LOG_CNT)
+    journal_checkpoint (seq);
+
+  /* The descriptor and the copies go in one request, the commit block
+     after them. */
+  if (desc->cnt > 0)
+    {
+      desc->magic = JOURNAL_DESC;
+      desc->seq = seq;
+      log_write (log_head, desc, desc->cnt + 1);
+      memset (&cblock, 0, sizeof cblock);
+      cblock.magic = JOURNAL_COMMIT;
+      cblock.seq = seq;
+      log_write ((log_head + desc->cnt + 1) % LOG_CNT, &cblock, 1);
+    }
+
+  lock_acquire (&lock_journal);
+  for (i = 0; i < desc->cnt; i++)
+    {
+      live[live_cnt].sector = desc->sectors[i];
+      live[live_cnt++].pos = (log_head + 1 + i) % LOG_CNT;
+    }
+  committing_cnt = 0;
+  lock_release (&lock_journal);
+  if (desc->cnt > 0)
+    {
+      log_head = (log_head + desc->cnt + 2) % LOG_CNT;
+      log_used += desc->cnt + 2;
+    }
+  committed_seq = seq;
+  lock_release (&lock_commit);
+}
+
+/* Commits the running transaction and empties the log. */
+static void
+journal_flush_log (void)
+{
+  journal_commit ();
+  lock_acquire (&lock_commit);
+  journal_checkpoint (running_seq);
+  lock_release (&lock_commit);
+}
+
+/* Returns true if SECTOR is one of the CNT sectors starting at FIRST. */
+static bool
+in_range (block_sector_t sector, block_sector_t first, size_t cnt)
+{
+  return sector >= first && sector - first < cnt;
+}
+
+/* Returns true if the log holds a copy of one of the CNT sectors
+   starting at SECTOR, or is about to.  The caller holds lock_journal. */
+static bool
+journal_holds (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < txn_cnt; i++)
+    if (in_range (txn[i]->sector, sector, cnt))
+      return true;
+  for (i = 0; i < committing_cnt; i++)
+    if (in_range (committing[i], sector, cnt))
+      return true;
+  for (i = 0; i < live_cnt; i++)
+    if (in_range (live[i].sector, sector, cnt))
+      return true;
+  return false;
+}
+
+/* Called by free_map_release before it releases CNT sectors starting at
+   SECTOR.  Returns true if the log holds one of them, in which case they
+   are released later by journal_release_pending. */
+bool
+journal_defer_release (block_sector_t sector, size_t cnt)
+{
+  struct journal_free *f;
+  bool held;
+
+  if (!journal_on)
+    return false;
+  lock_acquire (&lock_journal);
+  held = journal_holds (sector, cnt);
+  lock_release (&lock_journal);
+  if (!held)
+    return false;
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    return false;             // released at once, as without a journal
+  f->sector = sector;
+  f->cnt = cnt;
+  lock_acquire (&lock_journal);
+  list_push_back (&list_free, &f->elem);
+  lock_release (&lock_journal);
+  return true;
+}
+
+/* Releases the deferred sectors that the log does not hold anymore. */
+static void
+journal_release_pending (void)
+{
+  struct list ready;
+  struct list_elem *e, *next;
+  struct journal_free *f;
+
+  if (list_empty (&list_free))
+    return;
+  list_init (&ready);
+  lock_acquire (&lock_journal);
+  for (e = list_begin (&list_free); e != list_end (&list_free); e = next)
+    {
+      next = list_next (e);
+      f = list_entry (e, struct journal_free, elem);
+      if (!journal_holds (f->sector, f->cnt))
+	{
+	  list_remove (e);
+	  list_push_back (&ready, e);
+	}
+    }
+  lock_release (&lock_journal);
+  if (list_empty (&ready))
+    return;
+
+  journal_begin ();
+  free_map_batch_begin ();
+  while (!list_empty (&ready))
+    {
+      f = list_entry (list_pop_front (&ready), struct journal_free, elem);
+      free_map_release (f->sector, f->cnt);
+      free (f);
+    }
+  free_map_batch_end ();
+  journal_end ();
+}
@@ -0,0 +1,29 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+struct cache_entry;
+
+/* The journal lives in the sectors after the root directory inode. */
+#define JOURNAL_SECTOR 2        /* Journal header sector. */
+#define JOURNAL_SECTORS 128     /* Header and log, in sectors. */
+#define JOURNAL_TXN_MAX 125     /* max metadata sectors in a transaction */
+
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+void journal_tick (void);
+void journal_sync (void);
+
+void journal_add (struct cache_entry *buffer);
+bool journal_pending (struct cache_entry *buffer);
+bool journal_defer_release (block_sector_t sector, size_t cnt);
+
+#endif /* filesys/journal.h */
@@ -28,7 +28,21 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FSSTAT,                 /* Reads file system statistics. */
+    SYS_FILESECTORS,            /* Obtain the sectors allocated to a file. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write several buffers to a file. */
+    SYS_PREAD,                  /* Read from a file at a given position. */
+    SYS_PWRITE,                 /* Write to a file at a given position. */
+    SYS_COPY_FILE_RANGE,        /* Copy between files in the kernel. */
+    SYS_FSYNC,                  /* Write a file and its metadata to disk. */
+    SYS_FDATASYNC,              /* Write the data of a file to disk. */
+    SYS_RING_SETUP,             /* Set up a syscall ring. */
+    SYS_RING_ENTER,             /* Run the operations queued in the ring. */
+    SYS_FILEDIRTY               /* Obtain the unwritten data of a file. */
   };
 
 #endif /* lib/syscall-nr.h */
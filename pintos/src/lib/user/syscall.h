@@ -15,6 +15,80 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* A buffer of readv() and writev(), which take at most IOV_MAX. */
+#define IOV_MAX 64
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    unsigned iov_len;           /* Bytes in the buffer. */
+  };
+
+/* File system statistics written by fsstat(), counted since boot.
+   The buffer cache counters are indexed by FSSTAT_META for
+   metadata (inodes, index blocks, directories and the free map)
+   and by FSSTAT_DATA for the contents of regular files. */
+#define FSSTAT_META 0
+#define FSSTAT_DATA 1
+struct fsstat
+  {
+    int cache_size;                         /* Sectors the cache holds. */
+    unsigned long long read_requests;       /* Disk reads issued. */
+    unsigned long long read_sectors;        /* Sectors read by them. */
+    unsigned long long write_requests;      /* Disk writes issued. */
+    unsigned long long write_sectors;       /* Sectors written by them. */
+    unsigned long long hits[2];             /* Lookups of cached sectors. */
+    unsigned long long misses[2];           /* Lookups reading the disk. */
+    unsigned long long evictions[2];        /* Cached sectors evicted. */
+    unsigned long long writebacks[2];       /* Delayed writes written. */
+    unsigned long long ra_hits[2];          /* Read-ahead sectors used. */
+    unsigned long long ra_wasted[2];        /* ...evicted without use. */
+    unsigned long long lock_waits[2];       /* Cache locks waited for. */
+    unsigned long long lock_wait_ticks[2];  /* Timer ticks waited. */
+    unsigned long long read_overlaps;       /* Reads of files begun while
+                                               another was in progress. */
+    unsigned long long open_lookups;        /* Opens looked up in the table
+                                               of open inodes. */
+    unsigned long long open_probes;         /* Comparisons of inodes in the
+                                               table, by any operation. */
+  };
+
+/* A syscall ring, set up once by ring_setup() in a page of the process.
+   The process queues operations at SQ_TAIL, ring_enter() runs the queued
+   ones from SQ_HEAD in one trap and posts their results at CQ_TAIL, and
+   the process takes them from CQ_HEAD.  The counters run freely, an
+   entry being at the counter modulo RING_ENTRIES. */
+#define RING_ENTRIES 32
+enum ring_op
+  {
+    RING_READ,                  /* read (fd, buf, len) */
+    RING_WRITE,                 /* write (fd, buf, len) */
+    RING_OPEN,                  /* open (buf) */
+    RING_CLOSE,                 /* close (fd) */
+    RING_SEEK                   /* seek (fd, len) */
+  };
+struct ring_sqe
+  {
+    int op;                     /* enum ring_op. */
+    int fd;                     /* File descriptor. */
+    void *buf;                  /* Buffer, or file name to open. */
+    unsigned len;               /* Bytes to move, or position to seek. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+struct ring_cqe
+  {
+    unsigned user_data;         /* From the submission. */
+    int result;                 /* What the system call returns, else 0. */
+  };
+struct syscall_ring
+  {
+    unsigned sq_head;           /* Next submission to run, by the kernel. */
+    unsigned sq_tail;           /* Next submission to queue. */
+    unsigned cq_head;           /* Next completion to take. */
+    unsigned cq_tail;           /* Next completion to post, by the kernel. */
+    struct ring_sqe sq[RING_ENTRIES];
+    struct ring_cqe cq[RING_ENTRIES];
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -45,4 +119,18 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool fsstat (struct fsstat *);
+int filesectors (int fd);
+int filedirty (int fd);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+bool fsync (int fd);
+bool fdatasync (int fd);
+bool ring_setup (struct syscall_ring *);
+int ring_enter (unsigned to_submit);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,85 @@
+/* Child process for open-many.
+   Opens its FILES_PER_CHILD files and keeps them open while it runs
+   the next child, so that the files of all the children are open at
+   once.  The last child then opens its files again ROUND_CNT times
+   over and checks with fsstat how many inodes the lookups in the
+   table of open inodes compared. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/open-many.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-open-many";
+
+/* Opens the file of INDEX, and fails if it cannot. */
+static int
+open_file (int index)
+{
+  char name[16];
+  int fd;
+
+  snprintf (name, sizeof name, "f%d", index);
+  fd = open (name);
+  if (fd < 2)
+    fail ("open \"%s\"", name);
+  return fd;
+}
+
+/* Opens the files of CHILD_IDX again ROUND_CNT times over, while the
+   first ones are still open, and checks the cost of the lookups. */
+static void
+reopen_files (int child_idx)
+{
+  struct fsstat before, after;
+  unsigned long long lookups, probes;
+  int round, i;
+
+  if (!fsstat (&before))
+    fail ("fsstat");
+  for (round = 0; round < ROUND_CNT; round++)
+    for (i = 0; i < FILES_PER_CHILD; i++)
+      close (open_file (child_idx * FILES_PER_CHILD + i));
+  if (!fsstat (&after))
+    fail ("fsstat");
+
+  lookups = after.open_lookups - before.open_lookups;
+  probes = after.open_probes - before.open_probes;
+  if (lookups < ROUND_CNT * FILES_PER_CHILD)
+    fail ("only %llu lookups of open inodes", lookups);
+  if (probes > lookups * MAX_PROBES)
+    fail ("%llu inodes compared in %llu lookups among %d open inodes",
+          probes, lookups, FILE_CNT);
+}
+
+int
+main (int argc, const char *argv[]) 
+{
+  int fds[FILES_PER_CHILD];
+  char cmd[32];
+  int child_idx;
+  pid_t pid;
+  int i;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  for (i = 0; i < FILES_PER_CHILD; i++)
+    fds[i] = open_file (child_idx * FILES_PER_CHILD + i);
+
+  if (child_idx + 1 < CHILD_CNT)
+    {
+      snprintf (cmd, sizeof cmd, "child-open-many %d", child_idx + 1);
+      CHECK ((pid = exec (cmd)) != PID_ERROR, "exec \"%s\"", cmd);
+      CHECK (wait (pid) == 0, "wait for \"%s\"", cmd);
+    }
+  else
+    reopen_files (child_idx);
+
+  for (i = 0; i < FILES_PER_CHILD; i++)
+    close (fds[i]);
+  return 0;
+}
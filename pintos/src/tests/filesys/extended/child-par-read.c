@@ -0,0 +1,51 @@
+/* Child process for par-read.
+   Reads the file written by our parent process a chunk at a
+   time, PASS_CNT times over, starting at a chunk that depends
+   on our index so that the children do not all read the same
+   sectors at once, and checks every chunk. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/par-read.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-par-read";
+
+static char buf1[BUF_SIZE];
+static char buf2[CHUNK_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  int child_idx;
+  int fd;
+  int pass;
+  size_t i;
+
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf1, sizeof buf1);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (i = 0; i < CHUNK_CNT; i++)
+      {
+        size_t ofs = (i + child_idx * CHUNK_CNT / 4) % CHUNK_CNT * CHUNK_SIZE;
+        int bytes_read;
+
+        seek (fd, ofs);
+        bytes_read = read (fd, buf2, CHUNK_SIZE);
+        CHECK (bytes_read == CHUNK_SIZE,
+               "%d-byte read at offset %zu in \"%s\" returned %d",
+               CHUNK_SIZE, ofs, file_name, bytes_read);
+        compare_bytes (buf2, buf1 + ofs, CHUNK_SIZE, ofs, file_name);
+      }
+  close (fd);
+
+  return child_idx;
+}
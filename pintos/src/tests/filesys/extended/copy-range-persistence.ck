@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (5000);
+check_archive ({"srcfile" => [$data],
+		"dstfile" => [substr ($data, 100)]});
+pass;
@@ -0,0 +1,42 @@
+/* Copies part of a file into another with copy_file_range, which
+   must advance both positions and stop at the end of the source. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5000];
+
+void
+test_main (void) 
+{
+  int in_fd, out_fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create ("srcfile", sizeof buf), "create \"srcfile\"");
+  CHECK ((in_fd = open ("srcfile")) > 1, "open \"srcfile\"");
+  CHECK (write (in_fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"srcfile\"");
+  CHECK (create ("dstfile", 0), "create \"dstfile\"");
+  CHECK ((out_fd = open ("dstfile")) > 1, "open \"dstfile\"");
+
+  msg ("seek \"srcfile\"");
+  seek (in_fd, 100);
+  CHECK (copy_file_range (in_fd, out_fd, 3000) == 3000,
+         "copy 3000 bytes");
+  CHECK (copy_file_range (in_fd, out_fd, 3000) == 1900,
+         "copy to end of \"srcfile\" copies 1900 bytes");
+  CHECK (copy_file_range (in_fd, out_fd, 3000) == 0,
+         "copy at end of \"srcfile\" copies nothing");
+  CHECK (tell (in_fd) == 5000 && tell (out_fd) == 4900,
+         "positions advanced");
+  CHECK (copy_file_range (in_fd, in_fd, 100) == -1,
+         "copy onto the range itself fails");
+
+  msg ("close \"srcfile\"");
+  close (in_fd);
+  msg ("close \"dstfile\"");
+  close (out_fd);
+  check_file ("dstfile", buf + 100, sizeof buf - 100);
+}
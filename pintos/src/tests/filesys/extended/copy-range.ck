@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(copy-range) begin
+(copy-range) create "srcfile"
+(copy-range) open "srcfile"
+(copy-range) write "srcfile"
+(copy-range) create "dstfile"
+(copy-range) open "dstfile"
+(copy-range) seek "srcfile"
+(copy-range) copy 3000 bytes
+(copy-range) copy to end of "srcfile" copies 1900 bytes
+(copy-range) copy at end of "srcfile" copies nothing
+(copy-range) positions advanced
+(copy-range) copy onto the range itself fails
+(copy-range) close "srcfile"
+(copy-range) close "dstfile"
+(copy-range) open "dstfile" for verification
+(copy-range) verified contents of "dstfile"
+(copy-range) close "dstfile"
+(copy-range) end
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Seeks far past the end of a file and writes a byte, which must
+   leave a hole: few sectors allocated, reading back as zeros. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[262145];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  char x = 'x';
+  int fd, sectors;
+  
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, sizeof buf - 1);
+  CHECK (write (fd, &x, 1) > 0, "write \"%s\"", file_name);
+  sectors = filesectors (fd);
+  CHECK (sectors > 0 && sectors <= 3,
+         "\"%s\" has 1 to 3 sectors allocated", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  buf[sizeof buf - 1] = x;
+  check_file (file_name, buf, sizeof buf);
+}
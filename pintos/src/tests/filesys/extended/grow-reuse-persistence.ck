@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"new" => ["\0" x 700 . "x" x 100 . "\0" x 500 . "y" x 300]});
+pass;
@@ -0,0 +1,47 @@
+/* Removes a file and creates another, which may get its sectors, then
+   writes into the middle of sectors past the end of the new file.  The
+   bytes around the writes must read back as zeros, not as the data of
+   the removed file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char old[4096];
+static char buf[1600];
+
+void
+test_main (void) 
+{
+  struct iovec iov[2];
+  int fd;
+
+  memset (old, 'o', sizeof old);
+  CHECK (create ("old", 0), "create \"old\"");
+  CHECK ((fd = open ("old")) > 1, "open \"old\"");
+  CHECK (write (fd, old, sizeof old) == sizeof old, "write \"old\"");
+  msg ("close \"old\"");
+  close (fd);
+  CHECK (remove ("old"), "remove \"old\"");
+
+  CHECK (create ("new", 0), "create \"new\"");
+  CHECK ((fd = open ("new")) > 1, "open \"new\"");
+  msg ("seek \"new\"");
+  seek (fd, 700);
+  memset (buf + 700, 'x', 100);
+  CHECK (write (fd, buf + 700, 100) == 100, "write \"new\"");
+
+  /* Two pieces into the same sector past the end of file. */
+  msg ("seek \"new\"");
+  seek (fd, 1300);
+  memset (buf + 1300, 'y', 300);
+  iov[0].iov_base = buf + 1300;
+  iov[0].iov_len = 100;
+  iov[1].iov_base = buf + 1400;
+  iov[1].iov_len = 200;
+  CHECK (writev (fd, iov, 2) == 300, "writev \"new\"");
+  msg ("close \"new\"");
+  close (fd);
+  check_file ("new", buf, sizeof buf);
+}
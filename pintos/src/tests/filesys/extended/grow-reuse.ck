@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-reuse) begin
+(grow-reuse) create "old"
+(grow-reuse) open "old"
+(grow-reuse) write "old"
+(grow-reuse) close "old"
+(grow-reuse) remove "old"
+(grow-reuse) create "new"
+(grow-reuse) open "new"
+(grow-reuse) seek "new"
+(grow-reuse) write "new"
+(grow-reuse) seek "new"
+(grow-reuse) writev "new"
+(grow-reuse) close "new"
+(grow-reuse) open "new" for verification
+(grow-reuse) verified contents of "new"
+(grow-reuse) close "new"
+(grow-reuse) end
+EOF
+pass;
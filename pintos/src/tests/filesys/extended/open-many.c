@@ -0,0 +1,40 @@
+/* Creates 2,000 files and keeps all of them open at the same time,
+   opened by a chain of processes, then opens them again and again
+   while they are open, to exercise the table of open inodes: a
+   lookup must compare few of the inodes in it.  The files are
+   removed at the end. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/extended/open-many.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char name[16];
+  pid_t pid;
+  int i;
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  CHECK ((pid = exec ("child-open-many 0")) != PID_ERROR,
+         "exec \"child-open-many 0\"");
+  CHECK (wait (pid) == 0, "open %d files in %d processes at once",
+         FILE_CNT, CHILD_CNT);
+
+  msg ("remove %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+}
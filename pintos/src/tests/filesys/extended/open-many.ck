@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(open-many) begin
+(open-many) create 2000 files
+(open-many) exec "child-open-many 0"
+(open-many) open 2000 files in 20 processes at once
+(open-many) remove 2000 files
+(open-many) end
+EOF
+pass;
@@ -0,0 +1,15 @@
+#ifndef TESTS_FILESYS_EXTENDED_OPEN_MANY_H
+#define TESTS_FILESYS_EXTENDED_OPEN_MANY_H
+
+/* Each process can only have so many files open, so the files are
+   opened by a chain of processes, FILES_PER_CHILD each. */
+#define CHILD_CNT 20
+#define FILES_PER_CHILD 100
+#define FILE_CNT (CHILD_CNT * FILES_PER_CHILD)
+
+/* The last process opens its files again ROUND_CNT times over, and an
+   open must compare at most MAX_PROBES inodes on average. */
+#define ROUND_CNT 10
+#define MAX_PROBES 8
+
+#endif /* tests/filesys/extended/open-many.h */
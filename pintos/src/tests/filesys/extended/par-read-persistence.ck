@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_archive ({"child-par-read" => "tests/filesys/extended/child-par-read",
+		"readfile" => [random_bytes (512 * 32)]});
+pass;
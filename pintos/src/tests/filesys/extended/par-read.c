@@ -0,0 +1,41 @@
+/* Writes a file, then has several subprocesses read all of it
+   at the same time, each starting at a different offset, so
+   that their reads of the same file overlap.  A single CPU
+   cannot show a speedup in time, so the file system counts the
+   reads that begin while another one is in progress, which
+   never happens if readers are serialized by any lock. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/extended/par-read.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+char buf[BUF_SIZE];
+
+#define CHILD_CNT 4
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  struct fsstat before, after;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write %zu bytes to \"%s\"", sizeof buf, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (fsstat (&before), "fsstat");
+  exec_children ("child-par-read", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+  CHECK (fsstat (&after), "fsstat");
+
+  if (after.read_overlaps == before.read_overlaps)
+    fail ("no read began while another was in progress");
+  msg ("reads overlapped");
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-read) begin
+(par-read) create "readfile"
+(par-read) open "readfile"
+(par-read) write 65536 bytes to "readfile"
+(par-read) close "readfile"
+(par-read) fsstat
+(par-read) exec child 1 of 4: "child-par-read 0"
+(par-read) exec child 2 of 4: "child-par-read 1"
+(par-read) exec child 3 of 4: "child-par-read 2"
+(par-read) exec child 4 of 4: "child-par-read 3"
+(par-read) wait for child 1 of 4 returned 0 (expected 0)
+(par-read) wait for child 2 of 4 returned 1 (expected 1)
+(par-read) wait for child 3 of 4 returned 2 (expected 2)
+(par-read) wait for child 4 of 4 returned 3 (expected 3)
+(par-read) fsstat
+(par-read) reads overlapped
+(par-read) end
+EOF
+pass;
@@ -0,0 +1,12 @@
+#ifndef TESTS_FILESYS_EXTENDED_PAR_READ_H
+#define TESTS_FILESYS_EXTENDED_PAR_READ_H
+
+/* The file is larger than the default buffer cache, so that readers
+   wait for the disk in the middle of their reads. */
+#define CHUNK_SIZE 512
+#define CHUNK_CNT 128
+#define BUF_SIZE (CHUNK_SIZE * CHUNK_CNT)
+#define PASS_CNT 2
+static const char file_name[] = "readfile";
+
+#endif /* tests/filesys/extended/par-read.h */
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (2000);
+check_archive ({"posfile" => [$data . substr ($data, 1000, 1000)]});
+pass;
@@ -0,0 +1,43 @@
+/* Writes and reads a file at given positions with pwrite and
+   pread, which must leave the file position alone. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf1[2000];
+static char buf2[3000];
+static char buf3[3000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "posfile";
+  int fd;
+
+  random_bytes (buf1, sizeof buf1);
+  memcpy (buf2, buf1, 2000);
+  memcpy (buf2 + 2000, buf1 + 1000, 1000);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf1, 2000) == 2000, "write 2000 bytes to \"%s\"",
+         file_name);
+  CHECK (pwrite (fd, buf1 + 1000, 1000, 2000) == 1000,
+         "pwrite 1000 bytes at offset 2000 in \"%s\"", file_name);
+  CHECK (tell (fd) == 2000, "position of \"%s\" is still 2000", file_name);
+
+  CHECK (pread (fd, buf3, 1500, 1500) == 1500,
+         "pread 1500 bytes at offset 1500 in \"%s\"", file_name);
+  compare_bytes (buf3, buf2 + 1500, 1500, 1500, file_name);
+  CHECK (pread (fd, buf3, 500, 2800) == 200,
+         "pread past end of \"%s\" returns 200 bytes", file_name);
+  compare_bytes (buf3, buf2 + 2800, 200, 2800, file_name);
+  CHECK (tell (fd) == 2000, "position of \"%s\" is still 2000", file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf2, sizeof buf2);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pos-rw) begin
+(pos-rw) create "posfile"
+(pos-rw) open "posfile"
+(pos-rw) write 2000 bytes to "posfile"
+(pos-rw) pwrite 1000 bytes at offset 2000 in "posfile"
+(pos-rw) position of "posfile" is still 2000
+(pos-rw) pread 1500 bytes at offset 1500 in "posfile"
+(pos-rw) pread past end of "posfile" returns 200 bytes
+(pos-rw) position of "posfile" is still 2000
+(pos-rw) close "posfile"
+(pos-rw) open "posfile" for verification
+(pos-rw) verified contents of "posfile"
+(pos-rw) close "posfile"
+(pos-rw) end
+EOF
+pass;
@@ -0,0 +1,72 @@
+/* Opens, writes, seeks, reads and closes a file through a syscall
+   ring, running most of the operations in one ring_enter. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Aligned so as not to cross a page. */
+static struct syscall_ring ring __attribute__ ((aligned (1024)));
+static char buf1[2048];
+static char buf2[sizeof buf1];
+
+/* Queues operation OP on FD with BUF and LEN in the ring. */
+static void
+queue (enum ring_op op, int fd, void *buf, unsigned len)
+{
+  struct ring_sqe *sqe = &ring.sq[ring.sq_tail % RING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = len;
+  sqe->user_data = ring.sq_tail;
+  ring.sq_tail++;
+}
+
+/* Takes the next completion from the ring and returns its result. */
+static int
+reap (void)
+{
+  struct ring_cqe *cqe = &ring.cq[ring.cq_head % RING_ENTRIES];
+
+  if (ring.cq_head == ring.cq_tail)
+    fail ("no completion left");
+  if (cqe->user_data != ring.cq_head)
+    fail ("completion %u for submission %u", ring.cq_head, cqe->user_data);
+  ring.cq_head++;
+  return cqe->result;
+}
+
+void
+test_main (void) 
+{
+  char file_name[] = "ringfile";
+  int fd, i;
+
+  random_bytes (buf1, sizeof buf1);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK (ring_setup (&ring), "ring_setup");
+
+  queue (RING_OPEN, 0, file_name, 0);
+  CHECK (ring_enter (1) == 1, "ring_enter open");
+  CHECK ((fd = reap ()) > 1, "open \"%s\"", file_name);
+
+  for (i = 0; i < 4; i++)
+    queue (RING_WRITE, fd, buf1 + i * 512, 512);
+  queue (RING_SEEK, fd, NULL, 0);
+  queue (RING_READ, fd, buf2, sizeof buf2);
+  queue (RING_CLOSE, fd, NULL, 0);
+  CHECK (ring_enter (7) == 7, "ring_enter write, seek, read and close");
+  for (i = 0; i < 4; i++)
+    if (reap () != 512)
+      fail ("write %d failed", i);
+  CHECK (reap () == 0, "seek \"%s\"", file_name);
+  CHECK (reap () == (int) sizeof buf2, "read \"%s\"", file_name);
+  compare_bytes (buf2, buf1, sizeof buf1, 0, file_name);
+  CHECK (reap () == 0, "close \"%s\"", file_name);
+  CHECK (ring_enter (1) == 0, "ring_enter with nothing queued");
+
+  check_file (file_name, buf1, sizeof buf1);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(ring-batch) begin
+(ring-batch) create "ringfile"
+(ring-batch) ring_setup
+(ring-batch) ring_enter open
+(ring-batch) open "ringfile"
+(ring-batch) ring_enter write, seek, read and close
+(ring-batch) seek "ringfile"
+(ring-batch) read "ringfile"
+(ring-batch) close "ringfile"
+(ring-batch) ring_enter with nothing queued
+(ring-batch) open "ringfile" for verification
+(ring-batch) verified contents of "ringfile"
+(ring-batch) close "ringfile"
+(ring-batch) end
+EOF
+pass;
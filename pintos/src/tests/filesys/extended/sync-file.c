@@ -0,0 +1,38 @@
+/* Writes a file and makes it durable with fdatasync and fsync,
+   which must have written its data to disk when they return:
+   none of its sectors may be left delayed write in the cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+
+void
+test_main (void) 
+{
+  const char *file_name = "syncfile";
+  int fd;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  CHECK (write (fd, buf, 1024) == 1024, "write 1024 bytes to \"%s\"",
+         file_name);
+  CHECK (fdatasync (fd), "fdatasync \"%s\"", file_name);
+  CHECK (filedirty (fd) == 0, "no sector of \"%s\" left to write",
+         file_name);
+
+  CHECK (write (fd, buf + 1024, 1024) == 1024, "write 1024 bytes to \"%s\"",
+         file_name);
+  CHECK (fsync (fd), "fsync \"%s\"", file_name);
+  CHECK (filedirty (fd) == 0, "no sector of \"%s\" left to write",
+         file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (!fsync (fd), "fsync of a closed file fails");
+  check_file (file_name, buf, sizeof buf);
+}
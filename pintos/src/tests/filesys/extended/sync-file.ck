@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(sync-file) begin
+(sync-file) create "syncfile"
+(sync-file) open "syncfile"
+(sync-file) write 1024 bytes to "syncfile"
+(sync-file) fdatasync "syncfile"
+(sync-file) no sector of "syncfile" left to write
+(sync-file) write 1024 bytes to "syncfile"
+(sync-file) fsync "syncfile"
+(sync-file) no sector of "syncfile" left to write
+(sync-file) close "syncfile"
+(sync-file) fsync of a closed file fails
+(sync-file) open "syncfile" for verification
+(sync-file) verified contents of "syncfile"
+(sync-file) close "syncfile"
+(sync-file) end
+EOF
+pass;
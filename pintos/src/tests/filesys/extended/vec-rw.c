@@ -0,0 +1,49 @@
+/* Writes a file with writev from buffers of different sizes, one
+   of them spanning pages, then reads it back with readv into
+   buffers split at other places. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf1[6000];
+static char buf2[sizeof buf1];
+
+void
+test_main (void) 
+{
+  const char *file_name = "vecfile";
+  struct iovec iov[3];
+  int fd;
+
+  random_bytes (buf1, sizeof buf1);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  iov[0].iov_base = buf1;
+  iov[0].iov_len = 100;
+  iov[1].iov_base = buf1 + 100;
+  iov[1].iov_len = 5000;
+  iov[2].iov_base = buf1 + 5100;
+  iov[2].iov_len = 900;
+  CHECK (writev (fd, iov, 3) == (int) sizeof buf1,
+         "writev %zu bytes to \"%s\"", sizeof buf1, file_name);
+
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 0);
+  iov[0].iov_base = buf2;
+  iov[0].iov_len = 1000;
+  iov[1].iov_base = buf2 + 1000;
+  iov[1].iov_len = 4000;
+  iov[2].iov_base = buf2 + 5000;
+  iov[2].iov_len = 1000;
+  CHECK (readv (fd, iov, 3) == (int) sizeof buf2,
+         "readv %zu bytes from \"%s\"", sizeof buf2, file_name);
+  compare_bytes (buf2, buf1, sizeof buf1, 0, file_name);
+  CHECK (readv (fd, iov, 3) == 0, "readv at end of \"%s\"", file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf1, sizeof buf1);
+}
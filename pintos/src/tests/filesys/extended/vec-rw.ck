@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vec-rw) begin
+(vec-rw) create "vecfile"
+(vec-rw) open "vecfile"
+(vec-rw) writev 6000 bytes to "vecfile"
+(vec-rw) seek "vecfile"
+(vec-rw) readv 6000 bytes from "vecfile"
+(vec-rw) readv at end of "vecfile"
+(vec-rw) close "vecfile"
+(vec-rw) open "vecfile" for verification
+(vec-rw) verified contents of "vecfile"
+(vec-rw) close "vecfile"
+(vec-rw) end
+EOF
+pass;
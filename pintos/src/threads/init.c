@@ -37,6 +37,7 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/inode.h"
 #endif
 
 #ifdef VM
@@ -269,6 +270,26 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache-size"))
+        cache_size = atoi (value);
+      else if (!strcmp (name, "-cache-age"))
+        cache_dirty_age = atoi (value);
+      else if (!strcmp (name, "-cache-dirty"))
+        cache_dirty_ratio = atoi (value);
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!cache_policy_select (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-inode-format"))
+        {
+          if (!strcmp (value, "extent"))
+            inode_extents = true;
+          else if (!strcmp (value, "blocks"))
+            inode_extents = false;
+          else
+            PANIC ("unknown inode format `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -395,6 +416,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache-size=N      Cache N disk sectors, at least 32 (64).\n"
+          "  -cache-age=MS      Write back buffers dirty for MS ms (1000).\n"
+          "  -cache-dirty=PCT   Write back early above PCT%% dirty (25).\n"
+          "  -cache-policy=NAME Replace buffers by lru, clock, 2q or arc (lru).\n"
+          "  -inode-format=FMT  Create inodes of extent or blocks format (extent).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
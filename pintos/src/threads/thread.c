@@ -127,7 +127,6 @@ thread_init (void)
   list_init (&lock_list);
 #ifdef USERPROG
   lock_init (&syscall_lock);
-  lock_init (&filesys_lock);
 #endif
 
   load_avg = 0;   /** initial system wide load average */
@@ -674,6 +673,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->magic = THREAD_MAGIC;
   t->cur_dir = NULL;         // set working directory
+  t->journal_depth = 0;      // not inside a file system operation
   /** for donate priority */
   t->priority = priority;
   t->priority_old = priority;
@@ -950,6 +950,7 @@ void init_process(struct thread *t)
   memset (t->fd_table, 0, sizeof (t->fd_table)); 
   /** Set next FD id, next value after STDIN_FILENO and STDOUT_FILENO */
   t->next_fd = 2;
+  t->ring = NULL;
   list_init (&t->child_list);
   sema_init (&t->sema_load, 0);
 
@@ -961,7 +962,6 @@ void init_process(struct thread *t)
   t->process->is_loaded = false;
   t->process->exit_code = -1;  
   sema_init (&t->process->sema_wait, 0);  //wait for an event to be happened
-  sema_init (&t->process->sema_disk, 0);  //wait for an event to be happened
 
   t->parent_id = running_thread()->tid;
 }
@@ -44,7 +44,6 @@ struct process
   bool    is_loaded;                  /**Program loaded */
   tid_t   pid;                        /**Process ID */
   struct list_elem child_elem;
-  struct semaphore sema_disk;         /**indicator of access filesys */
 };
 
 /* A kernel thread or user process.
@@ -126,6 +125,7 @@ struct thread
     int64_t recent_cpu;                 /** total ticks running in fixed-point
 					    format, initial to 0 */
     struct dir *cur_dir;                /** working directory */
+    int journal_depth;                  /** nesting of journal handles */
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
@@ -140,6 +140,7 @@ struct thread
     struct semaphore sema_load;         /**Event indicator of child loaded */
     struct process *process;            /**process info used to communicate 
 					   with parent */
+    struct syscall_ring *ring;          /**syscall ring, or NULL */
 #endif
 #ifdef VM
     void   *stack_pointer;              /*pointer to the bottom of stack*/
@@ -158,8 +159,6 @@ extern bool thread_mlfqs;
 #ifdef USERPROG
 /** Lock used for syscall synchronization */
 struct lock syscall_lock;
-/** Lock used for accessing file system */
-struct lock filesys_lock;
 #endif
 
 void thread_init (void);
@@ -13,6 +13,7 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #ifdef VM
 #include "vm/frame.h"
 #include "vm/page.h"
@@ -20,6 +21,10 @@
 
 static void syscall_handler (struct intr_frame *);
 
+/* Pieces of user buffers pinned together by readv and writev: enough
+   for IOV_MAX buffers of up to a page each, which may cross a page. */
+#define IOV_PIECES (IOV_MAX * 2)
+
 static bool access_ok (const void *, unsigned);
 static bool valid_user_fd (int);
 static uint32_t read_argument (struct intr_frame *, int);
@@ -44,6 +49,17 @@ static bool sys_mkdir (const char *);
 static bool sys_readdir (int, char *);
 static bool sys_isdir (int);
 static int sys_isnumber (int);
+static bool sys_fsstat (struct fsstat *);
+static int sys_filesectors (int);
+static int sys_filedirty (int);
+static int sys_readv (int, const struct iovec *, int);
+static int sys_writev (int, const struct iovec *, int);
+static int sys_pread (int, void *, unsigned, unsigned);
+static int sys_pwrite (int, const void *, unsigned, unsigned);
+static int sys_copy_file_range (int, int, unsigned);
+static bool sys_fsync (int, bool);
+static bool sys_ring_setup (struct syscall_ring *);
+static int sys_ring_enter (unsigned);
 static int get_user (const uint8_t *);
 
 void
@@ -52,40 +68,11 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
-/** Synchronization:
-  Here's the scenario the Pintos docs may be worried about:
-  - User program begins a file write, vectors control to your syscall handler
-  - syscall handler acquires a lock on writing to disk
-  - During the write, a page fault occurs, control is vectored to the PF handler
-  - PF handler needs to evict a page back to disk; tries to acquire a lock on
-    writing to disk. This lock has already been acquired though; deadlock.
- */
-void 
-lock_filesys() 
-{
-  struct thread *t = thread_current();
-  if(lock_held_by_current_thread (&filesys_lock)) {
-    sema_up (&t->process->sema_disk); // raise semaphore lock has been hold 
-  } else {
-    lock_acquire (&filesys_lock);
-  }
-}
-
-void 
-unlock_filesys()
-{
-  struct thread *t = thread_current();
-  //if semaphore is up, do not release lock.
-  if (!sema_try_down(&t->process->sema_disk)) {
-    lock_release (&filesys_lock);
-  }
-}
-
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
   int syscall_no;
-  uint32_t arg0, arg1, arg2, arg3;
+  uint32_t arg0, arg1, arg2, arg3, arg4;
   struct thread *t = thread_current();
 
   arg0 = read_argument(f, 0);
@@ -156,48 +143,98 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_MMAP:                   /* Map a file into memory. */
       arg1 = read_argument(f, 1);
       arg2 = read_argument(f, 2);
-      lock_filesys();
       f->eax = sys_mmap((int) arg1, (void *) arg2);
-      unlock_filesys();
       break;
     case SYS_MUNMAP:                 /* Remove a memory mapping. */
       arg1 = read_argument(f, 1);
-      lock_filesys();
       sys_munmap((mapid_t) arg1);
-      unlock_filesys();
       break;
 
     /* Project 4 only. */
     case SYS_CHDIR:                  /* 15 Change the current directory. */
       arg1 = read_argument(f, 1);
-      lock_filesys();
       f->eax = sys_chdir((char *) arg1);
-      unlock_filesys();
       break;
     case SYS_MKDIR:                  /* Create a directory. */
       arg1 = read_argument(f, 1);
-      lock_filesys();
       f->eax = sys_mkdir((char *) arg1);
-      unlock_filesys();
       break;
     case SYS_READDIR:                /* Reads a directory entry. */
       arg1 = read_argument(f, 1);
       arg2 = read_argument(f, 2);
-      lock_filesys();
       f->eax = sys_readdir((int) arg1, (char *) arg2);
-      unlock_filesys();
       break;
     case SYS_ISDIR:                  /* Tests if a fd represents a directory. */
       arg1 = read_argument(f, 1);
-      lock_filesys();
       f->eax = sys_isdir((int) arg1);
-      unlock_filesys();
       break;
     case SYS_INUMBER:                /* 19 Returns the inode number for a fd. */
       arg1 = read_argument(f, 1);
-      lock_filesys();
       f->eax = sys_isnumber((int) arg1);
-      unlock_filesys();
+      break;
+
+    /* Extensions. */
+    case SYS_FSSTAT:                 /* 20 Reads file system statistics. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_fsstat((struct fsstat *) arg1);
+      break;
+    case SYS_FILESECTORS:            /* Obtain the sectors allocated to a file. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_filesectors((int) arg1);
+      break;
+    case SYS_READV:                  /* Read from a file into several buffers. */
+      arg1 = read_argument(f, 1);
+      arg2 = read_argument(f, 2);
+      arg3 = read_argument(f, 3);
+      f->eax = sys_readv((int) arg1, (struct iovec *) arg2, (int) arg3);
+      break;
+    case SYS_WRITEV:                 /* Write several buffers to a file. */
+      arg1 = read_argument(f, 1);
+      arg2 = read_argument(f, 2);
+      arg3 = read_argument(f, 3);
+      f->eax = sys_writev((int) arg1, (struct iovec *) arg2, (int) arg3);
+      break;
+    case SYS_PREAD:                  /* Read from a file at a given position. */
+      arg1 = read_argument(f, 1);
+      arg2 = read_argument(f, 2);
+      arg3 = read_argument(f, 3);
+      arg4 = read_argument(f, 4);
+      f->eax = sys_pread((int) arg1, (void *) arg2, (unsigned) arg3,
+			 (unsigned) arg4);
+      break;
+    case SYS_PWRITE:                 /* Write to a file at a given position. */
+      arg1 = read_argument(f, 1);
+      arg2 = read_argument(f, 2);
+      arg3 = read_argument(f, 3);
+      arg4 = read_argument(f, 4);
+      f->eax = sys_pwrite((int) arg1, (void *) arg2, (unsigned) arg3,
+			  (unsigned) arg4);
+      break;
+    case SYS_COPY_FILE_RANGE:        /* Copy between files in the kernel. */
+      arg1 = read_argument(f, 1);
+      arg2 = read_argument(f, 2);
+      arg3 = read_argument(f, 3);
+      f->eax = sys_copy_file_range((int) arg1, (int) arg2, (unsigned) arg3);
+      break;
+    case SYS_FSYNC:                  /* Write a file and its metadata to disk. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_fsync((int) arg1, false);
+      break;
+    case SYS_FDATASYNC:              /* Write the data of a file to disk. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_fsync((int) arg1, true);
+      break;
+    case SYS_RING_SETUP:             /* Set up a syscall ring. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_ring_setup((struct syscall_ring *) arg1);
+      break;
+    case SYS_RING_ENTER:             /* Run the operations queued in the ring. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_ring_enter((unsigned) arg1);
+      break;
+    case SYS_FILEDIRTY:              /* Obtain the unwritten data of a file. */
+      arg1 = read_argument(f, 1);
+      f->eax = sys_filedirty((int) arg1);
       break;
     default:
       break;
@@ -289,14 +326,12 @@ static bool sys_create (const char *file, unsigned initial_size)
 
   bool success = false;
   struct file *file_ptr;
-  lock_filesys();
   file_ptr = filesys_open (file);
   if (file_ptr == NULL)
     success = filesys_create (file, initial_size);
   else
     file_close (file_ptr);
 
-  unlock_filesys();
   return success;
 }
 
@@ -308,9 +343,7 @@ static bool sys_remove (const char *file)
 
   bool success = false;
 
-  lock_filesys();
   success = filesys_remove (file);
-  unlock_filesys();
   return success;
 
 }
@@ -324,9 +357,7 @@ static int sys_open (const char *file)
   struct thread *t = thread_current ();
  
   /* Get file info*/
-  lock_filesys();
   struct file *file_ = filesys_open(file);
-  unlock_filesys();
   int fd = -1;
 
   if (file_ != NULL) {
@@ -352,9 +383,7 @@ static int sys_filesize (int fd)
   struct file *file_ = t->fd_table[fd];
   
   if (file_ != NULL) {
-    lock_filesys();
     size = file_length(file_);
-    unlock_filesys();
   }
   return size;
 }
@@ -400,9 +429,7 @@ static int sys_read (int fd, void *buffer, unsigned size)
 	bytes_to_read = PGSIZE - pg_ofs (buffer);
 	page_read_bytes = size < bytes_to_read ? size : bytes_to_read; 
 	page_pin (upage);
-	lock_filesys ();
 	num_read = file_read (file_, buffer, page_read_bytes);
-	unlock_filesys ();
 	page_unpin (upage);
 	
 	size -= page_read_bytes;
@@ -446,9 +473,7 @@ static int sys_write (int fd, const void *buffer, unsigned size)
 	bytes_to_write = PGSIZE - pg_ofs (buffer);
 	page_write_bytes = size < bytes_to_write ? size : bytes_to_write; 
 	page_pin (upage);
-	lock_filesys ();
 	num_written = file_write (file_, buffer, page_write_bytes);
-	unlock_filesys ();
 	page_unpin (upage);
 	
 	size -= page_write_bytes;
@@ -472,9 +497,7 @@ static void sys_seek (int fd, unsigned position)
   struct file *file_ = t->fd_table[fd];
   
   if (file_ != NULL) {
-    lock_filesys();
     file_seek(file_, position);
-    unlock_filesys();
   }
 }
 
@@ -491,9 +514,7 @@ static int sys_tell (int fd)
   struct file *file_ = t->fd_table[fd];
   
   if (file_ != NULL) {
-    lock_filesys();
     position = file_tell(file_);
-    unlock_filesys();
   }
   return position;
 }
@@ -510,9 +531,7 @@ static void sys_close (int fd)
   struct file *file_ = t->fd_table[fd];
   
   if (file_ != NULL) {
-    lock_filesys();
     file_close(file_);
-    unlock_filesys();
     t->fd_table[fd] = NULL;
   }
 }
@@ -668,10 +687,8 @@ static bool sys_mkdir (const char *dir)
     sys_exit(-1);
   bool success = false;
 
-  lock_filesys();
   success = filesys_mkdir (dir);
 
-  unlock_filesys();
   return success;
   return false;
 }
@@ -727,14 +744,406 @@ static int sys_isnumber (int fd)
   struct file *file_ = t->fd_table[fd];
   
   if (file_ != NULL) {
-    lock_filesys();
     inumber = inode_get_inumber (file_get_inode (file_));
-    unlock_filesys();
   }
 
   return inumber;
 }
 
+static bool sys_fsstat (struct fsstat *st)
+{
+  struct fsstat stats;
+
+  /** verify parameters */
+  if (!access_ok (st, sizeof *st))
+    sys_exit(-1);
+
+  cache_get_stats (&stats);
+  inode_get_stats (&stats);
+  memcpy (st, &stats, sizeof *st);
+  return true;
+}
+
+/* Returns the number of sectors allocated to the file open as FD, its
+   data and index blocks, or -1 if FD is not open. */
+static int sys_filesectors (int fd)
+{
+  /** verify parameters */
+  if (!valid_user_fd(fd))
+    sys_exit(-1);
+
+  struct thread *t = thread_current ();
+  int sectors = -1;
+
+  /* Get file info*/
+  struct file *file_ = t->fd_table[fd];
+
+  if (file_ != NULL) {
+    sectors = inode_allocated (file_get_inode (file_));
+  }
+  return sectors;
+}
+
+/* Returns the number of data sectors of the file open as FD that are
+   delayed write in the buffer cache, or -1 if FD is not open. */
+static int sys_filedirty (int fd)
+{
+  /** verify parameters */
+  if (!valid_user_fd(fd))
+    sys_exit(-1);
+
+  struct file *file_ = thread_current ()->fd_table[fd];
+
+  if (file_ == NULL)
+    return -1;
+  return inode_dirty (file_get_inode (file_));
+}
+
+/* Copies the IOVCNT user buffers of UIOV into IOV, and exits if one
+   is bad. */
+static void
+copy_iov (struct iovec *iov, const struct iovec *uiov, int iovcnt)
+{
+  int i;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX
+      || !access_ok (uiov, iovcnt * sizeof *uiov))
+    sys_exit(-1);
+  memcpy (iov, uiov, iovcnt * sizeof *iov);
+  for (i = 0; i < iovcnt; i++)
+    if (!access_ok (iov[i].iov_base, iov[i].iov_len))
+      sys_exit(-1);
+}
+
+/* Reads into or, if WRITE, writes from the CNT pieces of IOV, no piece
+   crossing a page, with FILE_ pinning their pages for the inode
+   operation.  Returns the bytes moved. */
+static off_t
+transfer_pieces (struct file *file_, struct iovec *iov, int cnt, bool write)
+{
+  off_t bytes;
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    page_pin (pg_round_down (iov[i].iov_base));
+  if (write)
+    bytes = file_writev (file_, iov, cnt);
+  else
+    bytes = file_readv (file_, iov, cnt);
+  for (i = 0; i < cnt; i++)
+    page_unpin (pg_round_down (iov[i].iov_base));
+  return bytes;
+}
+
+/* Reads into or, if WRITE, writes from the IOVCNT buffers of IOV with
+   FILE_.  Unlike sys_read and sys_write, which pin and transfer a page
+   at a time, the buffers are split into pieces of a page at most, and
+   up to IOV_PIECES of them are pinned together and moved by one inode
+   operation.  A record in up to IOV_MAX buffers of a page or less is
+   thus always read or written as one; only a transfer of more than
+   IOV_PIECES pages takes several inode operations, which another
+   writer may come between.  Returns -1 if out of memory. */
+static int
+transfer_iov (struct file *file_, const struct iovec *iov, int iovcnt,
+	      bool write)
+{
+  struct iovec *pieces;
+  uint8_t *base;
+  unsigned ofs, len;
+  off_t bytes, total = 0, expected = 0;
+  int cnt = 0, i;
+
+  // too large for the kernel stack
+  pieces = malloc (IOV_PIECES * sizeof *pieces);
+  if (pieces == NULL)
+    return -1;
+
+  for (i = 0; i < iovcnt; i++)
+    for (ofs = 0; ofs < iov[i].iov_len; ofs += len)
+      {
+	base = (uint8_t *) iov[i].iov_base + ofs;
+	len = PGSIZE - pg_ofs (base);
+	if (len > iov[i].iov_len - ofs)
+	  len = iov[i].iov_len - ofs;
+	pieces[cnt].iov_base = base;
+	pieces[cnt++].iov_len = len;
+	expected += len;
+	if (cnt == IOV_PIECES)
+	  {
+	    bytes = transfer_pieces (file_, pieces, cnt, write);
+	    total += bytes;
+	    if (bytes < expected)
+	      goto done;
+	    cnt = 0;
+	    expected = 0;
+	  }
+      }
+  if (cnt > 0)
+    total += transfer_pieces (file_, pieces, cnt, write);
+ done:
+  free (pieces);
+  return total;
+}
+
+/* Reads from FD into the IOVCNT buffers of IOV in turn, and returns
+   the number of bytes read like sys_read. */
+static int sys_readv (int fd, const struct iovec *uiov, int iovcnt)
+{
+  struct iovec iov[IOV_MAX];
+
+  /** verify parameters */
+  if (!valid_user_fd(fd) || fd == STDOUT_FILENO)
+    sys_exit(-1);
+  copy_iov (iov, uiov, iovcnt);
+
+  struct thread *t = thread_current ();
+  int byte_read = -1;
+  unsigned i;
+  int j;
+
+  if (fd == STDIN_FILENO) {
+    byte_read = 0;
+    for (j = 0; j < iovcnt; j++)
+      for (i = 0; i < iov[j].iov_len; i++, byte_read++)
+	((char *) iov[j].iov_base)[i] = input_getc();
+  } else {
+    /* Get file info*/
+    struct file *file_ = t->fd_table[fd];
+
+    if (file_ != NULL)
+      byte_read = transfer_iov (file_, iov, iovcnt, false);
+  }
+  return byte_read;
+}
+
+/* Writes the IOVCNT buffers of IOV in turn to FD, and returns the
+   number of bytes written like sys_write. */
+static int sys_writev (int fd, const struct iovec *uiov, int iovcnt)
+{
+  struct iovec iov[IOV_MAX];
+
+  /** verify parameters */
+  if (!valid_user_fd(fd) || fd == STDIN_FILENO)
+    sys_exit(-1);
+  copy_iov (iov, uiov, iovcnt);
+
+  struct thread *t = thread_current ();
+  int byte_written = -1;
+  int j;
+
+  if (fd == STDOUT_FILENO) {
+    byte_written = 0;
+    for (j = 0; j < iovcnt; j++) {
+      putbuf (iov[j].iov_base, iov[j].iov_len);
+      byte_written += iov[j].iov_len;
+    }
+  } else {
+    /* Get file info*/
+    struct file *file_ = t->fd_table[fd];
+
+    if (file_ != NULL && !inode_is_dir(file_get_inode(file_)))
+      byte_written = transfer_iov (file_, iov, iovcnt, true);
+  }
+  return byte_written;
+}
+
+/* Reads SIZE bytes from FD into BUFFER starting at OFFSET, like
+   sys_read but leaving the file position alone, so that several
+   readers can share FD without seeking.  Returns -1 if FD is not a
+   file. */
+static int sys_pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  /** verify parameters */
+  if (!access_ok (buffer, size) || !valid_user_fd(fd) || fd == STDOUT_FILENO)
+    sys_exit(-1);
+
+  struct thread *t = thread_current ();
+  struct file *file_ = t->fd_table[fd];
+  int byte_read = -1;
+  int num_read;
+  unsigned page_read_bytes;
+  void *upage;
+
+  if (fd != STDIN_FILENO && file_ != NULL && (int) offset >= 0) {
+    byte_read = 0;
+    while (size > 0) {
+      upage = pg_round_down (buffer);
+      page_read_bytes = PGSIZE - pg_ofs (buffer);
+      if (page_read_bytes > size)
+	page_read_bytes = size;
+      page_pin (upage);
+      num_read = file_read_at (file_, buffer, page_read_bytes,
+			       offset + byte_read);
+      page_unpin (upage);
+
+      byte_read += num_read;
+      if (num_read < (int) page_read_bytes)
+	break;                  // end of file
+      size -= page_read_bytes;
+      buffer += page_read_bytes;
+    }
+  }
+  return byte_read;
+}
+
+/* Writes SIZE bytes from BUFFER to FD starting at OFFSET, like
+   sys_write but leaving the file position alone.  Returns -1 if FD is
+   not a file. */
+static int sys_pwrite (int fd, const void *buffer, unsigned size,
+		       unsigned offset)
+{
+  /** verify parameters */
+  if (!access_ok (buffer, size) || !valid_user_fd(fd) || fd == STDIN_FILENO)
+    sys_exit(-1);
+
+  struct thread *t = thread_current ();
+  struct file *file_ = t->fd_table[fd];
+  int byte_written = -1;
+  int num_written;
+  unsigned page_write_bytes;
+  void *upage;
+
+  if (fd != STDOUT_FILENO && file_ != NULL
+      && !inode_is_dir (file_get_inode (file_)) && (int) offset >= 0) {
+    byte_written = 0;
+    while (size > 0) {
+      upage = pg_round_down (buffer);
+      page_write_bytes = PGSIZE - pg_ofs (buffer);
+      if (page_write_bytes > size)
+	page_write_bytes = size;
+      page_pin (upage);
+      num_written = file_write_at (file_, buffer, page_write_bytes,
+				   offset + byte_written);
+      page_unpin (upage);
+
+      byte_written += num_written;
+      if (num_written < (int) page_write_bytes)
+	break;
+      size -= page_write_bytes;
+      buffer += page_write_bytes;
+    }
+  }
+  return byte_written;
+}
+
+/* Copies SIZE bytes from FD_IN at its position to FD_OUT at its
+   position, through the buffer cache only, with no user buffer to
+   fill and pin.  Returns the number of bytes copied, less than SIZE at
+   the end of FD_IN, or -1 if either is not a file or both are the same
+   file and the two ranges overlap. */
+static int sys_copy_file_range (int fd_in, int fd_out, unsigned size)
+{
+  /** verify parameters */
+  if (!valid_user_fd(fd_in) || !valid_user_fd(fd_out)
+      || fd_in == STDOUT_FILENO || fd_out == STDIN_FILENO)
+    sys_exit(-1);
+
+  struct thread *t = thread_current ();
+  struct file *in = t->fd_table[fd_in];
+  struct file *out = t->fd_table[fd_out];
+  off_t in_pos, out_pos;
+
+  if (fd_in == STDIN_FILENO || fd_out == STDOUT_FILENO
+      || in == NULL || out == NULL || (int) size < 0
+      || inode_is_dir (file_get_inode (in))
+      || inode_is_dir (file_get_inode (out)))
+    return -1;
+  in_pos = file_tell (in);
+  out_pos = file_tell (out);
+  if (file_get_inode (in) == file_get_inode (out)
+      && in_pos < out_pos + (off_t) size && out_pos < in_pos + (off_t) size)
+    return -1;
+  return file_copy (out, in, size);
+}
+
+/* Writes what was written to FD to disk before returning, only its
+   data if DATA_ONLY and its length and sectors did not change.
+   Returns false if FD is not open. */
+static bool sys_fsync (int fd, bool data_only)
+{
+  /** verify parameters */
+  if (!valid_user_fd(fd))
+    sys_exit(-1);
+
+  struct thread *t = thread_current ();
+  struct file *file_ = t->fd_table[fd];
+
+  if (file_ == NULL)
+    return false;
+  inode_sync (file_get_inode (file_), data_only);
+  return true;
+}
+
+/* Makes RING, which must lie within one page of the process, its
+   syscall ring, and empties it.  Returns false if RING is not such. */
+static bool sys_ring_setup (struct syscall_ring *ring)
+{
+  /** verify parameters */
+  if (ring == NULL || !access_ok (ring, sizeof *ring)
+      || pg_round_down (ring) != pg_round_down ((uint8_t *) ring
+						+ sizeof *ring - 1))
+    return false;
+
+  ring->sq_head = ring->sq_tail = 0;
+  ring->cq_head = ring->cq_tail = 0;
+  thread_current ()->ring = ring;
+  return true;
+}
+
+/* Runs up to TO_SUBMIT operations queued in the syscall ring of the
+   process, in order, as if each were its own system call, and posts
+   the result of each; it stops early if the completions are full.
+   Only the ring is checked on entry, each operation then checks its
+   own buffer.  Returns the number of operations run, or -1 if the
+   process has no ring. */
+static int sys_ring_enter (unsigned to_submit)
+{
+  struct syscall_ring *ring = thread_current ()->ring;
+  struct ring_sqe sqe;
+  struct ring_cqe *cqe;
+  unsigned done = 0;
+  int result;
+
+  if (ring == NULL)
+    return -1;
+  if (!access_ok (ring, sizeof *ring))
+    sys_exit(-1);
+
+  while (done < to_submit && ring->sq_head != ring->sq_tail
+	 && ring->cq_tail - ring->cq_head < RING_ENTRIES) {
+    sqe = ring->sq[ring->sq_head % RING_ENTRIES];
+    ring->sq_head++;
+    result = 0;
+    switch (sqe.op)
+      {
+      case RING_READ:
+	result = sys_read (sqe.fd, sqe.buf, sqe.len);
+	break;
+      case RING_WRITE:
+	result = sys_write (sqe.fd, sqe.buf, sqe.len);
+	break;
+      case RING_OPEN:
+	result = sys_open (sqe.buf);
+	break;
+      case RING_CLOSE:
+	sys_close (sqe.fd);
+	break;
+      case RING_SEEK:
+	sys_seek (sqe.fd, sqe.len);
+	break;
+      default:
+	result = -1;
+	break;
+      }
+    cqe = &ring->cq[ring->cq_tail % RING_ENTRIES];
+    cqe->user_data = sqe.user_data;
+    cqe->result = result;
+    ring->cq_tail++;
+    done++;
+  }
+  return done;
+}
+
 /* Reads a byte at user virtual address UADDR.
    UADDR must be below PHYS_BASE.
    Returns the byte value if successful, -1 if a segfault
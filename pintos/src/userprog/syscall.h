@@ -4,8 +4,6 @@
 #include <user/syscall.h>
 
 void syscall_init (void);
-void lock_filesys (void);
-void unlock_filesys (void);
 
 
 #endif /* userprog/syscall.h */
@@ -9,6 +9,7 @@
 #include "threads/vaddr.h"
 #include "vm/frame.h"
 #include "vm/page.h"
+#include "filesys/cache.h"
 
 struct list frame_table; //track system frames usage to help with eviction. 
 struct lock frame_lock;
@@ -47,12 +48,14 @@ void frame_init (void)
    be obtained from the “user pool,” by calling palloc_get_page(PAL_USER). 
    You must use PAL_USER to avoid allocating from the “kernel pool”.
 
-   If no free page is available, call frame_get_evitor to evict a frame.
+   If no free page is available, ask the buffer cache to shrink by a page,
+   and call frame_victim to evict a frame if it cannot.
 */
 struct frame *frame_alloc (struct page *vpage)
 {
   struct list_elem *e;
   struct frame *frame;
+  void *kpage;
   bool found = false;
 
   lock_acquire (&frame_lock);
@@ -67,6 +70,22 @@ struct frame *frame_alloc (struct page *vpage)
   }
   lock_release (&frame_lock);
 
+  if (!found && (kpage = cache_shrink ()) != NULL) {
+    /* a page of the buffer cache becomes a new frame */
+    frame = malloc (sizeof (struct frame));
+    if (frame != NULL) {
+      frame->kpage = kpage;
+      frame->vpage = vpage;
+      frame->pinned = false;
+      lock_acquire (&frame_lock);
+      list_push_back (&frame_table, &frame->frame_elem);
+      lock_release (&frame_lock);
+      found = true;
+    } else {
+      palloc_free_page (kpage);
+    }
+  }
+
   if (!found) {
     /* no free frame found */
     frame = frame_victim (vpage);
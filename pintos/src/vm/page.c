@@ -198,16 +198,13 @@ bool page_in (void *vaddr)
   } else {
     vpage->frame->pinned = true;   //set frame pinned
 
-    lock_filesys();
-    file_seek (vpage->file, vpage->file_ofs);
-    if (file_read (vpage->file, vpage->frame->kpage, vpage->read_bytes) 
-	!= (int) vpage->read_bytes) {
+    if (file_read_at (vpage->file, vpage->frame->kpage, vpage->read_bytes,
+		      vpage->file_ofs) != (int) vpage->read_bytes) {
       success = false; 
     } else {
       memset (vpage->frame->kpage + vpage->read_bytes, 0, vpage->zero_bytes);
       success = true;
     }
-    unlock_filesys();
     // Keep text(writable=false) pinned
     // pass page-merge-seq, page-merge-par, page-merge-stk, page-merge-mm
     if (vpage->writable)
@@ -281,7 +278,6 @@ bool page_out (struct page *vpage)
       }
     } else if (vpage->file != NULL && vpage->mmap_id != MAP_FAILED) {
       //page source is mmap, write the dirty page to mmap file
-      lock_filesys();
       file_reopen (vpage->file);
       file_seek (vpage->file, vpage->file_ofs);
       if (file_write_at (vpage->file, vpage->vaddr, vpage->read_bytes,
@@ -291,7 +287,6 @@ bool page_out (struct page *vpage)
 	pagedir_set_dirty (t->pagedir, vpage->vaddr, false);
 	vpage->dirty = false;
       }
-      unlock_filesys();
     }
   }
 